@@ -0,0 +1,138 @@
+// This file is part of the smolcc project
+// SPDX-License-Identifier: MIT
+
+#include "alloc_trace.h"
+
+#ifdef SMOLCC_TRACE_ALLOCATIONS
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <string_view>
+#include <vector>
+
+#include <fmt/core.h>
+
+#include "timing.h"
+
+namespace {
+
+struct Counter {
+    std::atomic<std::uint64_t> count = 0;
+    std::atomic<std::uint64_t> bytes = 0;
+};
+
+struct Row {
+    Phase phase;
+    AllocationSite site;
+    std::uint64_t count;
+    std::uint64_t bytes;
+};
+
+}  // namespace
+
+static constexpr std::size_t num_phases = static_cast<std::size_t>(Phase::Count) + 1;
+static constexpr std::size_t num_sites = static_cast<std::size_t>(AllocationSite::Count);
+
+static constexpr std::array<std::string_view, num_sites> site_names{
+        "other",
+        "make_poly_value",
+        "poly_value copy",
+        "make_int_type",
+        "make_ptr_type",
+        "Token::Identifier",
+        "Token copy",
+        "Codegen::print",
+};
+
+// Rows shown in each ranking
+static constexpr std::size_t report_rows = 10;
+
+static std::array<std::array<Counter, num_sites>, num_phases> counters;
+static std::atomic<std::uint64_t> frees = 0;
+
+static thread_local AllocationSite current_site = AllocationSite::Other;
+
+AllocationScope::AllocationScope(AllocationSite site)
+        : active(current_site == AllocationSite::Other) {
+    if (active)
+        current_site = site;
+}
+
+AllocationScope::~AllocationScope() {
+    if (active)
+        current_site = AllocationSite::Other;
+}
+
+// Must not allocate
+static void record(std::size_t size) {
+    Counter& c = counters[static_cast<std::size_t>(current_phase())][static_cast<std::size_t>(current_site)];
+    c.count.fetch_add(1, std::memory_order_relaxed);
+    c.bytes.fetch_add(size, std::memory_order_relaxed);
+}
+
+void* operator new(std::size_t size) {
+    void* p = std::malloc(size ? size : 1);
+    if (!p)
+        throw std::bad_alloc{};
+    record(size);
+    return p;
+}
+
+void* operator new[](std::size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+    if (p)
+        frees.fetch_add(1, std::memory_order_relaxed);
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    operator delete(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    operator delete(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept {
+    operator delete(p);
+}
+
+std::string allocation_report() {
+    // Snapshot before formatting, which allocates
+    std::vector<Row> rows;
+    rows.reserve(num_phases * num_sites);
+    for (std::size_t p = 0; p < num_phases; p++) {
+        for (std::size_t s = 0; s < num_sites; s++)
+            rows.push_back({static_cast<Phase>(p), static_cast<AllocationSite>(s), counters[p][s].count.load(), counters[p][s].bytes.load()});
+    }
+    const std::uint64_t freed = frees.load();
+    std::erase_if(rows, [](const Row& r) { return r.count == 0; });
+
+    std::uint64_t total_count = 0;
+    std::uint64_t total_bytes = 0;
+    for (const Row& r : rows) {
+        total_count += r.count;
+        total_bytes += r.bytes;
+    }
+
+    std::string out = fmt::format("{} allocations, {} bytes, {} frees\n", total_count, total_bytes, freed);
+    auto ranking = [&](std::string_view title, auto key) {
+        std::sort(rows.begin(), rows.end(), [&](const Row& a, const Row& b) { return key(a) > key(b); });
+        out += fmt::format("\ntop allocators by {}\n{:<10} {:<20} {:>10} {:>12}\n", title, "phase", "site", "count", "bytes");
+        for (std::size_t i = 0; i < std::min(rows.size(), report_rows); i++)
+            out += fmt::format("{:<10} {:<20} {:>10} {:>12}\n", phase_name(rows[i].phase), site_names[static_cast<std::size_t>(rows[i].site)], rows[i].count, rows[i].bytes);
+    };
+    ranking("count", [](const Row& r) { return r.count; });
+    ranking("bytes", [](const Row& r) { return r.bytes; });
+    return out;
+}
+
+#endif
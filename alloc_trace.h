@@ -0,0 +1,52 @@
+// This file is part of the smolcc project
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+// Built with -DSMOLCC_TRACE_ALLOCATIONS, the global operator new counts every allocation against
+// the active compiler phase and call site, and main prints the top allocators at exit. Otherwise
+// TRACE_ALLOCATIONS compiles to nothing.
+
+// Call site buckets; allocations outside all of them count as Other
+enum class AllocationSite {
+    Other,
+    MakePolyValue,
+    PolyValueCopy,
+    MakeIntType,
+    MakePtrType,
+    TokenIdentifier,
+    TokenCopy,
+    CodegenPrint,
+    Count,
+};
+
+#ifdef SMOLCC_TRACE_ALLOCATIONS
+
+#include <string>
+
+// Attributes the allocations of its scope to `site`, unless an enclosing scope is already active:
+// the outermost scope wins. A deep poly_value copy thus counts once, as a copy. make_int_type
+// counts as itself when called directly, but as make_poly_value when it runs while make_poly_value
+// is constructing an object, as VariableExpr's default type argument does.
+class AllocationScope {
+public:
+    explicit AllocationScope(AllocationSite site);
+    ~AllocationScope();
+
+    AllocationScope(const AllocationScope&) = delete;
+    AllocationScope& operator=(const AllocationScope&) = delete;
+
+private:
+    bool active;
+};
+
+#define TRACE_ALLOCATIONS(site) AllocationScope allocation_scope{AllocationSite::site}
+
+// Top (phase, site) pairs by count and by bytes
+std::string allocation_report();
+
+#else
+
+#define TRACE_ALLOCATIONS(site) ((void)0)
+
+#endif
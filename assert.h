@@ -4,7 +4,16 @@
 #pragma once
 
 #include <exception>
+#include <stdexcept>
 
 #include <fmt/core.h>
 
-#define ASSERT(x) [&] { if (!(x)) { fmt::print("failed assert {}\n", #x); std::terminate(); } }()
+// Thrown in place of terminating on threads that set assert_throws
+struct AssertionFailure : std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+// Set by threads that report a failed compile and carry on, such as the compile server's workers
+inline thread_local bool assert_throws = false;
+
+#define ASSERT(x) [&] { if (!(x)) { if (assert_throws) throw AssertionFailure{"failed assert " #x}; fmt::print("failed assert {}\n", #x); std::terminate(); } }()
@@ -1,6 +1,21 @@
-g++ $(pkg-config --libs --cflags fmt) -std=c++20 main.cpp lexer.cpp parser.cpp -o build/main -g
-./build/main "$1" > test.s
-as test.s -o test.o
-ld -macosx_version_min 12.0.0 -o test test.o -lSystem -syslibroot `xcrun -sdk macosx --show-sdk-path` -arch arm64
-./test
+g++ $(pkg-config --libs --cflags fmt) -std=c++20 main.cpp alloc_trace.cpp cache.cpp codegen.cpp driver.cpp fuzzer.cpp interpreter.cpp lexer.cpp optimizer.cpp parser.cpp scheduler.cpp server.cpp simulator.cpp timing.cpp -o build/main -g ${TRACE_ALLOCATIONS:+-DSMOLCC_TRACE_ALLOCATIONS}
+if [ -n "$SIMULATE" ]; then
+    # Built-in simulator, no assembler or emulator needed; its counts go to stderr
+    ./build/main --run $FLAGS "$1" >&2
+elif [ "$(uname)" = Linux ]; then
+    # Freestanding ELF, run under a user-mode emulator unless the host is AArch64
+    ./build/main $FLAGS --target=aarch64-linux-gnu "$1" > test.s
+    ${CROSS_PREFIX-aarch64-linux-gnu-}as test.s -o test.o
+    ${CROSS_PREFIX-aarch64-linux-gnu-}ld -o test test.o
+    if [ "$(uname -m)" = aarch64 ]; then
+        ./test
+    else
+        ${QEMU:-qemu-aarch64} ./test
+    fi
+else
+    ./build/main $FLAGS "$1" > test.s
+    as test.s -o test.o
+    ld -macosx_version_min 12.0.0 -o test test.o -lSystem -syslibroot `xcrun -sdk macosx --show-sdk-path` -arch arm64
+    ./test
+fi
 echo $?
@@ -0,0 +1,71 @@
+// This file is part of the smolcc project
+// SPDX-License-Identifier: MIT
+
+#include "cache.h"
+
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <random>
+#include <system_error>
+
+#include <fmt/core.h>
+
+// 64-bit FNV-1a
+static std::uint64_t hash(std::string_view data) {
+    std::uint64_t h = 0xcbf29ce484222325;
+    for (unsigned char c : data) {
+        h ^= c;
+        h *= 0x100000001b3;
+    }
+    return h;
+}
+
+std::filesystem::path CompileCache::entry_path(std::string_view key) const {
+    return dir / fmt::format("{:016x}", hash(key));
+}
+
+// An entry is the key's length on its own line, then the key, then the output
+std::optional<std::string> CompileCache::lookup(std::string_view key) const {
+    std::ifstream file{entry_path(key), std::ios::binary};
+    if (!file)
+        return std::nullopt;
+
+    std::size_t key_size;
+    if (!(file >> key_size) || file.get() != '\n' || key_size != key.size())
+        return std::nullopt;
+
+    std::string stored_key(key_size, '\0');
+    if (!file.read(stored_key.data(), key_size) || stored_key != key)
+        return std::nullopt;
+
+    return std::string{std::istreambuf_iterator<char>{file}, {}};
+}
+
+void CompileCache::store(std::string_view key, std::string_view output) const {
+    std::error_code ec;
+    std::filesystem::create_directories(dir, ec);
+    if (ec)
+        return;
+
+    // Readers only ever see complete entries: each writer fills a private file and renames it into
+    // place, and the last rename wins
+    const std::filesystem::path path = entry_path(key);
+    std::filesystem::path tmp = path;
+    tmp += fmt::format(".tmp{:016x}", std::random_device{}() * std::uint64_t{0x100000000} + std::random_device{}());
+
+    {
+        std::ofstream file{tmp, std::ios::binary};
+        file << key.size() << '\n'
+             << key << output;
+        if (!file.flush()) {
+            file.close();
+            std::filesystem::remove(tmp, ec);
+            return;
+        }
+    }
+
+    std::filesystem::rename(tmp, path, ec);
+    if (ec)
+        std::filesystem::remove(tmp, ec);
+}
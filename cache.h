@@ -0,0 +1,28 @@
+// This file is part of the smolcc project
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+
+// A directory of compiler outputs, addressed by a hash of everything that determines them: the
+// compiler build, the options and the source. Entries also record the full key, so a hash
+// collision reads as a miss. Entries are published with an atomic rename, so concurrent compiles
+// may share a directory. Failures to read or write the cache are never fatal.
+class CompileCache {
+public:
+    explicit CompileCache(std::filesystem::path dir)
+            : dir(std::move(dir)) {}
+
+    std::optional<std::string> lookup(std::string_view key) const;
+    void store(std::string_view key, std::string_view output) const;
+
+private:
+    std::filesystem::path entry_path(std::string_view key) const;
+
+    std::filesystem::path dir;
+};
@@ -0,0 +1,1152 @@
+// This file is part of the smolcc project
+// SPDX-License-Identifier: MIT
+
+#include "codegen.h"
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "assert.h"
+#include "optimizer.h"
+
+// Locals occupy the bottom of a fixed-size frame below the frame record, in ascending address
+// order of declaration: [fp - frame_size, fp)
+static constexpr int frame_size = 8 * max_locals;
+
+// Condition code for which `lhs op rhs` holds after `cmp lhs, rhs`
+static std::optional<std::string_view> condition_code(BinOpKind op) {
+    switch (op) {
+    case BinOpKind::LessThan:
+        return "lt";  // signed compare
+    case BinOpKind::GreaterThan:
+        return "gt";  // signed compare
+    case BinOpKind::LessThanEqual:
+        return "le";  // signed compare
+    case BinOpKind::GreaterThanEqual:
+        return "ge";  // signed compare
+    case BinOpKind::Equal:
+        return "eq";
+    case BinOpKind::NotEqual:
+        return "ne";
+    default:
+        return std::nullopt;
+    }
+}
+
+static std::string_view invert_condition_code(std::string_view cc) {
+    if (cc == "lt")
+        return "ge";
+    if (cc == "gt")
+        return "le";
+    if (cc == "le")
+        return "gt";
+    if (cc == "ge")
+        return "lt";
+    if (cc == "eq")
+        return "ne";
+    if (cc == "ne")
+        return "eq";
+    ASSERT(!"Unknown condition code");
+    return {};
+}
+
+static bool is_zero_constant(const ExprVal& expr) {
+    auto e = expr.cast<IntegerConstantExpr>();
+    return e && e->value == 0;
+}
+
+// NZCV immediate under which condition code cc holds, or fails when holds is false
+static int nzcv_for(std::string_view cc, bool holds) {
+    constexpr int n = 8;
+    constexpr int z = 4;
+    if (cc == "eq")
+        return holds ? z : 0;
+    if (cc == "ne")
+        return holds ? 0 : z;
+    if (cc == "lt")
+        return holds ? n : 0;
+    if (cc == "ge")
+        return holds ? 0 : n;
+    if (cc == "gt")
+        return holds ? 0 : z;
+    if (cc == "le")
+        return holds ? z : 0;
+    ASSERT(!"Unknown condition code");
+    return 0;
+}
+
+static bool is_logical(BinOpKind op) {
+    return op == BinOpKind::LogicalAnd || op == BinOpKind::LogicalOr;
+}
+
+// Whether expr may be evaluated where the source would skip it: it has no side effects, cannot
+// fault, and its code leaves the flags untouched
+static bool is_speculatable(const ExprVal& expr) {
+    if (expr.cast<IntegerConstantExpr>() || expr.cast<VariableExpr>())
+        return true;
+
+    if (auto e = expr.cast<UnOpExpr>()) {
+        switch (e->op) {
+        case UnOpKind::AddressOf:
+            return static_cast<bool>(e->e.cast<VariableExpr>());
+        case UnOpKind::Posate:
+        case UnOpKind::Negate:
+            return is_speculatable(e->e);
+        default:
+            return false;
+        }
+    }
+
+    if (auto e = expr.cast<BinOpExpr>()) {
+        switch (e->op) {
+        case BinOpKind::Add:
+        case BinOpKind::Subtract:
+        case BinOpKind::Multiply:
+        case BinOpKind::Divide:  // sdiv does not trap on zero
+        case BinOpKind::Modulo:
+        case BinOpKind::BitAnd:
+        case BinOpKind::BitXor:
+        case BinOpKind::BitOr:
+            return is_speculatable(e->lhs) && is_speculatable(e->rhs);
+        default:
+            return false;
+        }
+    }
+
+    return false;
+}
+
+// Number of nodes in expr, standing in for the instructions it takes to evaluate
+static std::size_t expr_cost(const ExprVal& expr) {
+    if (auto e = expr.cast<UnOpExpr>())
+        return 1 + expr_cost(e->e);
+    if (auto e = expr.cast<BinOpExpr>())
+        return 1 + expr_cost(e->lhs) + expr_cost(e->rhs);
+    return 1;
+}
+
+// A data-dependent branch mispredicts often, costing over a dozen cycles each time, so evaluating
+// both arms of a diamond is cheaper as long as they are this small
+static constexpr std::size_t max_select_cost = 8;
+
+// An arm of an if/else diamond that can become a select: `x = value;` or `return value;`
+struct SelectArm {
+    const ExprVal* var;  // The assigned variable, or nullptr for a return
+    const ExprVal* value;
+};
+
+static std::optional<SelectArm> select_arm(const StmtVal& stmt) {
+    if (auto s = stmt.cast<CompoundStmt>(); s && s->items.size() == 1)
+        return select_arm(s->items[0]);
+    if (auto s = stmt.cast<ExprStmt>()) {
+        if (auto e = s->e.cast<AssignExpr>(); e && e->lhs.cast<VariableExpr>())
+            return SelectArm{&e->lhs, &e->rhs};
+    }
+    if (auto s = stmt.cast<ReturnStmt>(); s && s->e)
+        return SelectArm{nullptr, &s->e};
+    return std::nullopt;
+}
+
+// A logical operation whose rhs is a speculatable compare or value is evaluated with a ccmp chain
+// instead of branches
+static bool is_chainable(BinOpExpr* e) {
+    if (!is_logical(e->op))
+        return false;
+    if (auto r = e->rhs.cast<BinOpExpr>(); r && condition_code(r->op))
+        return is_speculatable(r->lhs) && is_speculatable(r->rhs);
+    return is_speculatable(e->rhs);
+}
+
+// Whether value can be encoded as the bitmask immediate of a logical instruction: a rotated run of
+// ones within an element of 2, 4, 8, 16, 32 or 64 bits, replicated across the register
+static bool is_logical_immediate(std::uint64_t value) {
+    if (value == 0 || value == ~std::uint64_t{0})
+        return false;
+
+    int size = 64;
+    while (size > 2) {
+        const int half = size / 2;
+        const std::uint64_t mask = (std::uint64_t{1} << half) - 1;
+        if ((value & mask) != ((value >> half) & mask))
+            break;
+        size = half;
+    }
+
+    const std::uint64_t mask = size == 64 ? ~std::uint64_t{0} : (std::uint64_t{1} << size) - 1;
+    const std::uint64_t element = value & mask;
+    for (int r = 0; r < size; r++) {
+        const std::uint64_t rotated = r == 0 ? element : ((element >> r) | (element << (size - r))) & mask;
+        if (std::has_single_bit(rotated + 1))
+            return true;
+    }
+    return false;
+}
+
+static std::uint64_t chunk(std::uint64_t value, int i) {
+    return (value >> (16 * i)) & 0xFFFF;
+}
+
+// Materializes value in the fewest instructions among movz/movn followed by movk, a single orr of a
+// bitmask immediate, and an orr followed by one movk
+void Codegen::emit_constant(std::string_view reg, std::uint64_t value) {
+    int zero_chunks = 0;
+    int ones_chunks = 0;
+    for (int i = 0; i < 4; i++) {
+        zero_chunks += chunk(value, i) == 0;
+        ones_chunks += chunk(value, i) == 0xFFFF;
+    }
+    const bool use_movn = ones_chunks > zero_chunks;
+    const int cost = std::max(1, 4 - std::max(zero_chunks, ones_chunks));
+
+    if (cost > 1 && is_logical_immediate(value)) {
+        print("orr {}, xzr, {:#x}\n", reg, value);
+        return;
+    }
+
+    if (cost > 2) {
+        // Borrow another chunk's bits for chunk i, then patch chunk i in with movk
+        for (int i = 0; i < 4; i++) {
+            for (int j = 0; j < 4; j++) {
+                const std::uint64_t clear = ~(std::uint64_t{0xFFFF} << (16 * i));
+                const std::uint64_t candidate = (value & clear) | (chunk(value, j) << (16 * i));
+                if (i == j || !is_logical_immediate(candidate))
+                    continue;
+                print("orr {}, xzr, {:#x}\n", reg, candidate);
+                print("movk {}, {}, lsl {}\n", reg, chunk(value, i), 16 * i);
+                return;
+            }
+        }
+    }
+
+    // The first chunk that movk would otherwise have to patch is set by movz or movn itself
+    const std::uint64_t fill = use_movn ? 0xFFFF : 0;
+    int first = 0;
+    while (first < 3 && chunk(value, first) == fill)
+        first++;
+    if (chunk(value, first) == fill)
+        first = 0;  // 0 or -1: a single unshifted movz or movn
+
+    const std::uint64_t imm = use_movn ? ~chunk(value, first) & 0xFFFF : chunk(value, first);
+    if (first == 0) {
+        print("{} {}, {}\n", use_movn ? "movn" : "movz", reg, imm);
+    } else {
+        print("{} {}, {}, lsl {}\n", use_movn ? "movn" : "movz", reg, imm, 16 * first);
+    }
+    for (int i = first + 1; i < 4; i++) {
+        if (chunk(value, i) != fill)
+            print("movk {}, {}, lsl {}\n", reg, chunk(value, i), 16 * i);
+    }
+}
+
+void Codegen::emit_addr(const ExprVal& expr) {
+    if (auto e = expr.cast<VariableExpr>()) {
+        print("sub x0, fp, {}\n", -fn.locals[e->ident]);
+        return;
+    }
+
+    if (auto e = expr.cast<UnOpExpr>()) {
+        switch (e->op) {
+        case UnOpKind::Dereference:
+            emit_expr(e->e);
+            return;
+        default:
+            ASSERT(!"Unknown unop kind");
+        }
+    }
+
+    ASSERT(!"!lvalue");
+}
+
+// Emits `x0 = base +/- index * scale`
+void Codegen::emit_scaled_addsub(bool is_add, std::string_view base, std::string_view index, std::size_t scale) {
+    if (std::has_single_bit(scale)) {
+        print("{} x0, {}, {}, lsl {}\n", is_add ? "add" : "sub", base, index, std::countr_zero(scale));
+        return;
+    }
+    emit_constant("x2", scale);
+    print("{} x0, {}, x2, {}\n", is_add ? "madd" : "msub", index, base);  // x0 = base +/- index * x2
+}
+
+// Emits `x0 = lhs +/- rhs`, lhs and rhs being registers holding the operands
+void Codegen::emit_addsub(BinOpExpr* e, std::string_view lhs, std::string_view rhs) {
+    const bool is_add = e->op == BinOpKind::Add;
+    const TypeVal lt = e->lhs->type();
+    const TypeVal rt = e->rhs->type();
+    const bool lp = lt->is_pointer();
+    const bool rp = rt->is_pointer();
+
+    if (lp && rp) {
+        ASSERT(!is_add && "pointer + pointer is invalid");
+        const std::size_t size = lt.cast<PointerType>()->base->size();
+        print("sub x0, {}, {}\n", lhs, rhs);
+        if (std::has_single_bit(size)) {
+            print("asr x0, x0, {}\n", std::countr_zero(size));
+            return;
+        }
+        emit_constant("x2", size);
+        print("sdiv x0, x0, x2\n");
+        return;
+    } else if (lp && !rp) {
+        emit_scaled_addsub(is_add, lhs, rhs, lt.cast<PointerType>()->base->size());
+        return;
+    } else if (!lp && rp) {
+        ASSERT(is_add && "integer - pointer is invalid");
+        emit_scaled_addsub(true, rhs, lhs, rt.cast<PointerType>()->base->size());
+        return;
+    }
+
+    print("{} x0, {}, {}\n", is_add ? "add" : "sub", lhs, rhs);
+}
+
+// Multiplier and post-shift for signed division by d using a multiply-high, as in Hacker's
+// Delight 10-1. d must not be -1, 0 or 1.
+static std::pair<std::int64_t, int> signed_magic(std::int64_t d) {
+    constexpr std::uint64_t two63 = std::uint64_t{1} << 63;
+    const std::uint64_t ad = d < 0 ? -static_cast<std::uint64_t>(d) : d;
+    const std::uint64_t t = two63 + (static_cast<std::uint64_t>(d) >> 63);
+    const std::uint64_t anc = t - 1 - t % ad;
+
+    int p = 63;
+    std::uint64_t q1 = two63 / anc, r1 = two63 - q1 * anc;
+    std::uint64_t q2 = two63 / ad, r2 = two63 - q2 * ad;
+    std::uint64_t delta;
+    do {
+        p++;
+        q1 *= 2;
+        r1 *= 2;
+        if (r1 >= anc) {
+            q1++;
+            r1 -= anc;
+        }
+        q2 *= 2;
+        r2 *= 2;
+        if (r2 >= ad) {
+            q2++;
+            r2 -= ad;
+        }
+        delta = ad - r2;
+    } while (q1 < delta || (q1 == delta && r1 == 0));
+
+    const std::uint64_t magic = q2 + 1;
+    return {static_cast<std::int64_t>(d < 0 ? -magic : magic), p - 64};
+}
+
+// x0 = x0 / divisor or x0 % divisor, truncating towards zero
+void Codegen::emit_divmod_by_constant(bool is_modulo, std::int64_t divisor) {
+    // The remainder takes the sign of the dividend, so only the divisor's magnitude matters
+    if (is_modulo && divisor < 0)
+        divisor = divisor == INT64_MIN ? divisor : -divisor;
+
+    const std::uint64_t magnitude = divisor < 0 ? -static_cast<std::uint64_t>(divisor) : divisor;
+
+    if (is_modulo) {
+        if (magnitude == 1) {
+            print("mov x0, xzr\n");
+            return;
+        }
+        print("mov x3, x0\n");
+    } else if (divisor == 1) {
+        return;
+    } else if (divisor == -1) {
+        print("neg x0, x0\n");
+        return;
+    }
+
+    if (std::has_single_bit(magnitude)) {
+        // Bias negative dividends by magnitude - 1 so the shift rounds towards zero
+        const int k = std::countr_zero(magnitude);
+        print("asr x1, x0, 63\n");
+        print("add x1, x0, x1, lsr {}\n", 64 - k);
+        if (is_modulo) {
+            print("asr x0, x1, {}\n", k);
+            print("sub x0, x3, x0, lsl {}\n", k);
+            return;
+        }
+        print("asr x0, x1, {}\n", k);
+        if (divisor < 0)
+            print("neg x0, x0\n");
+        return;
+    }
+
+    const auto [magic, shift] = signed_magic(divisor);
+    emit_constant("x2", static_cast<std::uint64_t>(magic));
+    print("smulh x1, x0, x2\n");
+    if (divisor > 0 && magic < 0)
+        print("add x1, x1, x0\n");
+    if (divisor < 0 && magic > 0)
+        print("sub x1, x1, x0\n");
+    if (shift != 0)
+        print("asr x1, x1, {}\n", shift);
+    print("add x0, x1, x1, lsr 63\n");  // round towards zero
+
+    if (is_modulo) {
+        emit_constant("x2", static_cast<std::uint64_t>(divisor));
+        print("msub x0, x0, x2, x3\n");
+    }
+}
+
+// Scaled offset of `lhs +/- constant` if it fits an add/sub immediate
+static std::optional<std::uint64_t> addsub_immediate(BinOpExpr* e) {
+    if (e->op != BinOpKind::Add && e->op != BinOpKind::Subtract)
+        return std::nullopt;
+    auto c = e->rhs.cast<IntegerConstantExpr>();
+    if (!c)
+        return std::nullopt;
+
+    const TypeVal lt = e->lhs->type();
+    const std::uint64_t scale = lt->is_pointer() ? lt.cast<PointerType>()->base->size() : 1;
+    if (c->value >= 4096 || c->value * scale >= 4096)
+        return std::nullopt;
+    return c->value * scale;
+}
+
+void Codegen::emit_expr(const ExprVal& expr) {
+    if (auto e = expr.cast<IntegerConstantExpr>()) {
+        emit_loc(expr);
+        emit_constant("x0", e->value);
+        return;
+    }
+
+    if (auto e = expr.cast<VariableExpr>()) {
+        print("ldr x0, [fp, {}]\n", fn.locals[e->ident]);
+        return;
+    }
+
+    if (auto e = expr.cast<UnOpExpr>()) {
+        if (e->op == UnOpKind::AddressOf) {
+            emit_addr(e->e);
+            return;
+        }
+
+        emit_expr(e->e);
+
+        emit_loc(expr);
+        switch (e->op) {
+        case UnOpKind::Dereference:
+            print("ldr x0, [x0]\n");
+            return;
+        case UnOpKind::Posate:
+            // do nothing
+            return;
+        case UnOpKind::Negate:
+            print("neg x0, x0\n");
+            return;
+        default:
+            ASSERT(!"Unknown unop kind");
+        }
+    }
+
+    if (auto e = expr.cast<BinOpExpr>()) {
+        if (auto cc = condition_code(e->op)) {
+            emit_compare(e);
+            emit_loc(expr);
+            print("cset x0, {}\n", *cc);
+            return;
+        }
+
+        if (is_chainable(e)) {
+            const std::string_view cc = emit_condition(expr);
+            emit_loc(expr);
+            print("cset x0, {}\n", cc);
+            return;
+        }
+
+        if (is_logical(e->op)) {
+            const int i = new_label();
+            emit_branch(expr, false, fmt::format(".logic{}.false", i));
+            emit_constant("x0", 1);
+            print("b .logic{}.end\n", i);
+            print(".logic{}.false:\n", i);
+            emit_constant("x0", 0);
+            print(".logic{}.end:\n", i);
+            return;
+        }
+
+        if (auto imm = addsub_immediate(e)) {
+            emit_expr(e->lhs);
+            emit_loc(expr);
+            if (*imm != 0)
+                print("{} x0, x0, {}\n", e->op == BinOpKind::Add ? "add" : "sub", *imm);
+            return;
+        }
+
+        if (auto c = e->rhs.cast<IntegerConstantExpr>(); c && c->value != 0 && (e->op == BinOpKind::Divide || e->op == BinOpKind::Modulo)) {
+            emit_expr(e->lhs);
+            emit_loc(expr);
+            emit_divmod_by_constant(e->op == BinOpKind::Modulo, static_cast<std::int64_t>(c->value));
+            return;
+        }
+
+        // A zero operand is read from xzr rather than materialized
+        std::string_view lhs = "x1";
+        std::string_view rhs = "x0";
+        if (is_zero_constant(e->lhs)) {
+            emit_expr(e->rhs);
+            lhs = "xzr";
+        } else if (is_zero_constant(e->rhs)) {
+            emit_expr(e->lhs);
+            lhs = "x0";
+            rhs = "xzr";
+        } else {
+            emit_expr(e->lhs);
+            print("str x0, [sp, -16]!\n");
+            emit_expr(e->rhs);
+            print("ldr x1, [sp], 16\n");
+        }
+
+        emit_loc(expr);
+        switch (e->op) {
+        case BinOpKind::Add:
+        case BinOpKind::Subtract:
+            emit_addsub(e, lhs, rhs);
+            return;
+        case BinOpKind::Multiply:
+            print("mul x0, {}, {}\n", lhs, rhs);
+            return;
+        case BinOpKind::Divide:
+            print("sdiv x0, {}, {}\n", lhs, rhs);
+            return;
+        case BinOpKind::Modulo:
+            print("sdiv x2, {}, {}\n", lhs, rhs);
+            print("msub x0, x2, {}, {}\n", rhs, lhs);
+            return;
+        case BinOpKind::BitAnd:
+            print("and x0, {}, {}\n", lhs, rhs);
+            return;
+        case BinOpKind::BitXor:
+            print("eor x0, {}, {}\n", lhs, rhs);
+            return;
+        case BinOpKind::BitOr:
+            print("orr x0, {}, {}\n", lhs, rhs);
+            return;
+        default:
+            ASSERT(!"Unknown binop kind");
+        }
+    }
+
+    if (auto e = expr.cast<AssignExpr>()) {
+        emit_assign(e, true);
+        return;
+    }
+
+    ASSERT(!"Unknown expr kind");
+}
+
+// Stores zero straight from xzr. x0 then only holds the assigned value if value_used is set.
+void Codegen::emit_assign(AssignExpr* e, bool value_used) {
+    const bool is_zero = is_zero_constant(e->rhs);
+    if (auto v = e->lhs.cast<VariableExpr>()) {
+        if (is_zero) {
+            print("str xzr, [fp, {}]\n", fn.locals[v->ident]);
+        } else {
+            emit_expr(e->rhs);
+            print("str x0, [fp, {}]\n", fn.locals[v->ident]);
+            return;
+        }
+    } else if (is_zero) {
+        emit_addr(e->lhs);
+        print("str xzr, [x0]\n");
+    } else {
+        emit_addr(e->lhs);
+        print("str x0, [sp, -16]!\n");
+        emit_expr(e->rhs);
+        print("ldr x1, [sp], 16\n");
+        print("str x0, [x1]\n");
+        return;
+    }
+    if (value_used)
+        print("mov x0, xzr\n");
+}
+
+// Evaluates expr for its side effects alone, leaving x0 unspecified
+void Codegen::emit_discarded(const ExprVal& expr) {
+    if (auto e = expr.cast<AssignExpr>()) {
+        emit_assign(e, false);
+        return;
+    }
+    emit_expr(expr);
+}
+
+// Sets flags for the comparison `lhs op rhs`, comparing against an immediate where the constant
+// operand allows it instead of materializing it
+void Codegen::emit_compare(BinOpExpr* e) {
+    if (is_zero_constant(e->lhs)) {
+        emit_expr(e->rhs);
+        print("cmp xzr, x0\n");
+        return;
+    }
+    if (auto c = e->rhs.cast<IntegerConstantExpr>()) {
+        if (c->value < 4096) {
+            emit_expr(e->lhs);
+            print("cmp x0, {}\n", c->value);
+            return;
+        }
+        if (-c->value < 4096) {
+            emit_expr(e->lhs);
+            print("cmn x0, {}\n", -c->value);
+            return;
+        }
+    }
+
+    emit_expr(e->lhs);
+    print("str x0, [sp, -16]!\n");
+    emit_expr(e->rhs);
+    print("ldr x1, [sp], 16\n");
+    print("cmp x1, x0\n");
+}
+
+// Sets flags such that the returned condition code holds exactly when expr is nonzero. Chainable
+// && and || become a cmp followed by ccmp: when the lhs already decides the result, ccmp sets
+// flags that give the rhs condition code that result instead of comparing.
+std::string_view Codegen::emit_condition(const ExprVal& expr) {
+    if (auto e = expr.cast<BinOpExpr>()) {
+        if (auto cc = condition_code(e->op)) {
+            emit_compare(e);
+            return *cc;
+        }
+
+        if (is_chainable(e)) {
+            const bool is_and = e->op == BinOpKind::LogicalAnd;
+            const std::string_view lhs_cc = emit_condition(e->lhs);
+            const std::string_view compare_when = is_and ? lhs_cc : invert_condition_code(lhs_cc);
+
+            auto r = e->rhs.cast<BinOpExpr>();
+            const std::optional<std::string_view> rhs_cc = r ? condition_code(r->op) : std::nullopt;
+            const std::string_view cc = rhs_cc.value_or("ne");
+            const int nzcv = nzcv_for(cc, !is_and);
+
+            auto c = rhs_cc ? r->rhs.cast<IntegerConstantExpr>() : nullptr;
+            if (!rhs_cc) {
+                emit_expr(e->rhs);
+                print("ccmp x0, 0, {}, {}\n", nzcv, compare_when);
+            } else if (c && c->value < 32) {
+                emit_expr(r->lhs);
+                print("ccmp x0, {}, {}, {}\n", c->value, nzcv, compare_when);
+            } else if (c && -c->value < 32) {
+                emit_expr(r->lhs);
+                print("ccmn x0, {}, {}, {}\n", -c->value, nzcv, compare_when);
+            } else {
+                emit_expr(r->lhs);
+                print("str x0, [sp, -16]!\n");
+                emit_expr(r->rhs);
+                print("ldr x1, [sp], 16\n");
+                print("ccmp x1, x0, {}, {}\n", nzcv, compare_when);
+            }
+            return cc;
+        }
+    }
+
+    emit_expr(expr);
+    print("cmp x0, 0\n");
+    return "ne";
+}
+
+// Branches to label if cond evaluates to when, otherwise falls through
+void Codegen::emit_branch(const ExprVal& cond, bool when, std::string_view label) {
+    if (auto e = cond.cast<BinOpExpr>(); e && is_logical(e->op)) {
+        if (is_chainable(e)) {
+            const std::string_view cc = emit_condition(cond);
+            emit_loc(cond);
+            print("b.{} {}\n", when ? cc : invert_condition_code(cc), label);
+            return;
+        }
+
+        // && is decided by a false lhs and || by a true one. The rhs is only reached otherwise.
+        const bool decided_by = e->op == BinOpKind::LogicalOr;
+        if (decided_by == when) {
+            emit_branch(e->lhs, when, label);
+            emit_branch(e->rhs, when, label);
+        } else {
+            const std::string skip = fmt::format(".logic{}.skip", new_label());
+            emit_branch(e->lhs, decided_by, skip);
+            emit_branch(e->rhs, when, label);
+            print("{}:\n", skip);
+        }
+        return;
+    }
+
+    if (auto e = cond.cast<BinOpExpr>()) {
+        if (auto cc = condition_code(e->op)) {
+            const bool is_eq = e->op == BinOpKind::Equal;
+            if ((is_eq || e->op == BinOpKind::NotEqual) && (is_zero_constant(e->lhs) || is_zero_constant(e->rhs))) {
+                emit_expr(is_zero_constant(e->rhs) ? e->lhs : e->rhs);
+                emit_loc(cond);
+                print("{} x0, {}\n", is_eq == when ? "cbz" : "cbnz", label);
+                return;
+            }
+
+            emit_compare(e);
+            emit_loc(cond);
+            print("b.{} {}\n", when ? *cc : invert_condition_code(*cc), label);
+            return;
+        }
+    }
+
+    emit_expr(cond);
+    print("{} x0, {}\n", when ? "cbnz" : "cbz", label);
+}
+
+// Evaluates if_true or if_false, both speculatable, according to condition code cc, which the
+// caller has set up. csinc and csneg increment or negate their second operand, so an arm of the
+// form `e + 1` or `-e` is computed from e for free.
+void Codegen::emit_select(std::string_view cc, const ExprVal& if_true, const ExprVal& if_false) {
+    auto modifier = [](const ExprVal& expr) -> std::pair<std::string_view, const ExprVal*> {
+        if (auto e = expr.cast<UnOpExpr>(); e && e->op == UnOpKind::Negate)
+            return {"csneg", &e->e};
+        if (auto e = expr.cast<BinOpExpr>(); e && e->op == BinOpKind::Add && !e->type()->is_pointer()) {
+            if (auto c = e->rhs.cast<IntegerConstantExpr>(); c && c->value == 1)
+                return {"csinc", &e->lhs};
+        }
+        return {"csel", &expr};
+    };
+
+    std::string_view op = "csel";
+    const ExprVal* first = &if_true;
+    const ExprVal* second = &if_false;
+    if (auto [m, base] = modifier(if_false); m != "csel") {
+        op = m;
+        second = base;
+    } else if (auto [m, base] = modifier(if_true); m != "csel") {
+        op = m;
+        first = &if_false;
+        second = base;
+        cc = invert_condition_code(cc);
+    }
+
+    // Zero is read from xzr rather than materialized
+    const bool first_is_zero = is_zero_constant(*first);
+    const bool second_is_zero = is_zero_constant(*second);
+    if (!first_is_zero) {
+        emit_expr(*first);
+        if (!second_is_zero)
+            print("str x0, [sp, -16]!\n");
+    }
+    if (!second_is_zero) {
+        emit_expr(*second);
+        if (!first_is_zero)
+            print("ldr x1, [sp], 16\n");
+    }
+    const std::string_view first_reg = first_is_zero ? "xzr" : second_is_zero ? "x0" : "x1";
+    const std::string_view second_reg = second_is_zero ? "xzr" : "x0";
+    print("{} x0, {}, {}, {}\n", op, first_reg, second_reg, cc);
+}
+
+// Replaces a small diamond whose arms assign the same local, or both return, with a select. Returns
+// false when s does not qualify.
+bool Codegen::emit_if_conversion(IfStmt* s) {
+    const auto then_arm = select_arm(s->then_);
+    if (!then_arm)
+        return false;
+
+    std::optional<SelectArm> else_arm;
+    if (s->else_) {
+        else_arm = select_arm(s->else_);
+    } else if (then_arm->var) {
+        else_arm = SelectArm{then_arm->var, then_arm->var};  // if (c) x = a; is x = c ? a : x
+    }
+    if (!else_arm || static_cast<bool>(then_arm->var) != static_cast<bool>(else_arm->var))
+        return false;
+    if (then_arm->var && (*then_arm->var).cast<VariableExpr>()->ident != (*else_arm->var).cast<VariableExpr>()->ident)
+        return false;
+
+    const ExprVal& if_true = *then_arm->value;
+    const ExprVal& if_false = *else_arm->value;
+    if (!is_speculatable(if_true) || !is_speculatable(if_false))
+        return false;
+    if (expr_cost(if_true) + expr_cost(if_false) > max_select_cost)
+        return false;
+    // A logical condition that needs branches would defeat the purpose
+    if (auto e = s->cond.cast<BinOpExpr>(); e && is_logical(e->op) && !is_chainable(e))
+        return false;
+
+    // The condition is evaluated first, as its side effects may feed the arms
+    const std::string_view cc = emit_condition(s->cond);
+    emit_loc(s->cond);
+    emit_select(cc, if_true, if_false);
+
+    if (then_arm->var) {
+        print("str x0, [fp, {}]\n", fn.locals[(*then_arm->var).cast<VariableExpr>()->ident]);
+    } else {
+        emit_epilogue();
+    }
+    return true;
+}
+
+// Operands of a VectorLoopStmt. The counter, bound and pointers live in x9-x15, broadcast values
+// in v16-v19 and intermediate results in v24-v31.
+struct VectorOperands {
+    std::vector<ExprVal> loads;
+    std::vector<ExprVal> broadcasts;
+    std::map<const Expr*, int> index;
+    int depth = 0;
+};
+
+static bool contains_load(const ExprVal& expr) {
+    if (auto e = expr.cast<UnOpExpr>())
+        return e->op == UnOpKind::Dereference || contains_load(e->e);
+    if (auto e = expr.cast<BinOpExpr>())
+        return contains_load(e->lhs) || contains_load(e->rhs);
+    return false;
+}
+
+static void collect_vector_operands(const ExprVal& expr, VectorOperands& ops, int depth) {
+    ops.depth = std::max(ops.depth, depth + 1);
+
+    if (auto e = expr.cast<UnOpExpr>(); e && e->op == UnOpKind::Dereference) {
+        auto addr = e->e.cast<BinOpExpr>();
+        ops.index[expr.operator->()] = ops.loads.size();
+        ops.loads.emplace_back(addr->lhs->type()->is_pointer() ? addr->lhs : addr->rhs);
+        return;
+    }
+
+    if (!contains_load(expr)) {
+        ops.index[expr.operator->()] = ops.broadcasts.size();
+        ops.broadcasts.emplace_back(expr);
+        return;
+    }
+
+    if (auto e = expr.cast<UnOpExpr>()) {
+        collect_vector_operands(e->e, ops, depth);
+    } else if (auto e = expr.cast<BinOpExpr>()) {
+        collect_vector_operands(e->lhs, ops, depth);
+        collect_vector_operands(e->rhs, ops, depth + 1);
+    }
+}
+
+// Locals whose values expr reads
+static void collect_variables(const ExprVal& expr, std::set<std::string>& vars) {
+    if (auto e = expr.cast<VariableExpr>()) {
+        vars.insert(e->ident);
+    } else if (auto e = expr.cast<UnOpExpr>(); e && e->op != UnOpKind::AddressOf) {
+        collect_variables(e->e, vars);
+    } else if (auto e = expr.cast<BinOpExpr>()) {
+        collect_variables(e->lhs, vars);
+        collect_variables(e->rhs, vars);
+    }
+}
+
+// Evaluates one iteration's worth of lanes of expr, returning the register holding the result
+std::string Codegen::emit_vector_expr(const ExprVal& expr, const VectorOperands& ops, int depth) {
+    const std::string dst = fmt::format("v{}", 24 + depth);
+
+    if (auto e = expr.cast<UnOpExpr>(); e && e->op == UnOpKind::Dereference) {
+        print("add x1, x{}, x9, lsl 3\n", 12 + ops.index.at(expr.operator->()));
+        print("ld1 {{{}.2d}}, [x1]\n", dst);
+        return dst;
+    }
+
+    if (!contains_load(expr)) {
+        return fmt::format("v{}", 16 + ops.index.at(expr.operator->()));
+    }
+
+    if (auto e = expr.cast<UnOpExpr>()) {
+        const std::string src = emit_vector_expr(e->e, ops, depth);
+        switch (e->op) {
+        case UnOpKind::Posate:
+            return src;
+        case UnOpKind::Negate:
+            print("neg {}.2d, {}.2d\n", dst, src);
+            return dst;
+        default:
+            ASSERT(!"Unknown vector unop kind");
+        }
+    }
+
+    if (auto e = expr.cast<BinOpExpr>()) {
+        const std::string lhs = emit_vector_expr(e->lhs, ops, depth);
+        const std::string rhs = emit_vector_expr(e->rhs, ops, depth + 1);
+        switch (e->op) {
+        case BinOpKind::Add:
+            print("add {}.2d, {}.2d, {}.2d\n", dst, lhs, rhs);
+            return dst;
+        case BinOpKind::Subtract:
+            print("sub {}.2d, {}.2d, {}.2d\n", dst, lhs, rhs);
+            return dst;
+        case BinOpKind::BitAnd:
+            print("and {}.16b, {}.16b, {}.16b\n", dst, lhs, rhs);
+            return dst;
+        case BinOpKind::BitXor:
+            print("eor {}.16b, {}.16b, {}.16b\n", dst, lhs, rhs);
+            return dst;
+        case BinOpKind::BitOr:
+            print("orr {}.16b, {}.16b, {}.16b\n", dst, lhs, rhs);
+            return dst;
+        default:
+            ASSERT(!"Unknown vector binop kind");
+        }
+    }
+
+    ASSERT(!"Unknown vector expr kind");
+    return {};
+}
+
+void Codegen::emit_vector_loop(VectorLoopStmt* s) {
+    VectorOperands ops;
+    collect_vector_operands(s->value, ops, 0);
+    if (ops.loads.size() > 4 || ops.broadcasts.size() > 4 || ops.depth > 8) {
+        // Out of registers: the scalar loop runs every iteration
+        return;
+    }
+
+    const int i = new_label();
+    const int counter = fn.locals[s->counter];
+
+    print("ldr x9, [fp, {}]\n", counter);
+    emit_expr(s->bound);
+    print("mov x10, x0\n");
+    emit_expr(s->dst);
+    print("mov x11, x0\n");
+    for (std::size_t k = 0; k < ops.loads.size(); k++) {
+        emit_expr(ops.loads[k]);
+        print("mov x{}, x0\n", 12 + k);
+    }
+    for (std::size_t k = 0; k < ops.broadcasts.size(); k++) {
+        emit_expr(ops.broadcasts[k]);
+        print("dup v{}.2d, x0\n", 16 + k);
+    }
+
+    // The stored range is [x2, x2 + x3)
+    print("cmp x9, x10\n");
+    print("b.ge .vec{}.end\n", i);
+    print("add x2, x11, x9, lsl 3\n");
+    print("sub x3, x10, x9\n");
+    print("lsl x3, x3, 3\n");
+
+    // Loading from just below the store would read elements an earlier lane has not yet stored
+    for (std::size_t k = 0; k < ops.loads.size(); k++) {
+        print("sub x0, x11, x{}\n", 12 + k);
+        print("sub x0, x0, 1\n");
+        print("cmp x0, 15\n");
+        print("b.lo .vec{}.end\n", i);
+    }
+
+    // The store must not clobber the locals read above
+    std::set<std::string> scalars{s->counter};
+    collect_variables(s->bound, scalars);
+    collect_variables(s->dst, scalars);
+    for (auto& e : ops.loads) {
+        collect_variables(e, scalars);
+    }
+    for (auto& e : ops.broadcasts) {
+        collect_variables(e, scalars);
+    }
+    for (auto& v : scalars) {
+        print("sub x0, fp, {}\n", -fn.locals[v]);
+        print("sub x0, x0, x2\n");
+        print("cmp x0, x3\n");
+        print("b.lo .vec{}.end\n", i);
+    }
+
+    // Nor may a lane load read the counter, which is only written back once the loop finishes
+    for (std::size_t k = 0; k < ops.loads.size(); k++) {
+        print("add x1, x{}, x9, lsl 3\n", 12 + k);
+        print("sub x0, fp, {}\n", -counter);
+        print("sub x0, x0, x1\n");
+        print("cmp x0, x3\n");
+        print("b.lo .vec{}.end\n", i);
+    }
+
+    // Rotated like scalar loops: both lanes must be in bounds on entry and after each step
+    print("add x0, x9, 2\n");
+    print("cmp x0, x10\n");
+    print("b.gt .vec{}.done\n", i);
+    print(".vec{}.loop:\n", i);
+    const std::string value = emit_vector_expr(s->value, ops, 0);
+    print("add x1, x11, x9, lsl 3\n");
+    print("st1 {{{}.2d}}, [x1]\n", value);
+    print("add x9, x9, 2\n");
+    print("add x0, x9, 2\n");
+    print("cmp x0, x10\n");
+    print("b.le .vec{}.loop\n", i);
+    print(".vec{}.done:\n", i);
+    print("str x9, [fp, {}]\n", counter);
+    print(".vec{}.end:\n", i);
+}
+
+void Codegen::emit_stmt(const StmtVal& stmt) {
+    if (auto s = stmt.cast<CompoundStmt>()) {
+        // Every path past a statement that sets x0 runs through it, so the values of the
+        // expression statements before it are never read
+        auto sets_x0 = [](const StmtVal& item) {
+            auto e = item.cast<ExprStmt>();
+            auto r = item.cast<ReturnStmt>();
+            return (e && e->e) || (r && r->e);
+        };
+        const auto last = std::find_if(s->items.rbegin(), s->items.rend(), sets_x0).base();
+        for (auto it = s->items.begin(); it != s->items.end(); ++it) {
+            auto e = it->cast<ExprStmt>();
+            if (e && e->e && it + 1 < last)
+                emit_discarded(e->e);
+            else
+                emit_stmt(*it);
+        }
+        return;
+    }
+
+    if (auto s = stmt.cast<ExprStmt>()) {
+        if (s->e)
+            emit_expr(s->e);
+        return;
+    }
+
+    if (auto s = stmt.cast<IfStmt>()) {
+        if (emit_if_conversion(s))
+            return;
+
+        const int i = new_label();
+
+        // An arm that returns while the other falls through is predicted not taken. It is laid
+        // out after the function body so that the likely path runs straight through.
+        if (!falls_through(s->then_) && (!s->else_ || falls_through(s->else_))) {
+            const std::string label = fmt::format(".if{}.then", i);
+            emit_branch(s->cond, true, label);
+            declare_locals(s->then_);
+            cold_blocks.emplace_back(label, &s->then_);
+            if (s->else_)
+                emit_stmt(s->else_);
+            return;
+        }
+        if (s->else_ && !falls_through(s->else_) && falls_through(s->then_)) {
+            const std::string label = fmt::format(".if{}.else", i);
+            emit_branch(s->cond, false, label);
+            emit_stmt(s->then_);
+            declare_locals(s->else_);
+            cold_blocks.emplace_back(label, &s->else_);
+            return;
+        }
+
+        emit_branch(s->cond, false, fmt::format(".if{}.else", i));
+        emit_stmt(s->then_);
+        print("b .if{}.end\n", i);
+        print(".if{}.else:\n", i);
+        if (s->else_)
+            emit_stmt(s->else_);
+        print(".if{}.end:\n", i);
+        return;
+    }
+
+    if (auto s = stmt.cast<LoopStmt>()) {
+        const int i = new_label();
+        // The loop only falls through after testing the condition, which sets x0
+        if (s->init) {
+            emit_discarded(s->init);
+        }
+        // Rotated: the condition guards entry and is then tested at the bottom, so an iteration
+        // runs a single branch. The loop falls through with x0 as the failed test left it, holding
+        // the last operand emit_compare evaluated: the lhs when comparing against an immediate, the
+        // rhs otherwise (`i < n` leaves n, and so does `0 < n`), or 0 for a plain value.
+        if (s->cond) {
+            emit_branch(s->cond, false, fmt::format(".loop{}.end", i));
+        }
+        print(".loop{}.body:\n", i);
+        emit_stmt(s->then);
+        if (s->incr)
+            emit_discarded(s->incr);
+        if (s->cond)
+            emit_branch(s->cond, true, fmt::format(".loop{}.body", i));
+        else
+            print("b .loop{}.body\n", i);
+        print(".loop{}.end:\n", i);
+        return;
+    }
+
+    if (auto s = stmt.cast<VectorLoopStmt>()) {
+        emit_loc(stmt);
+        emit_vector_loop(s);
+        return;
+    }
+
+    if (auto s = stmt.cast<ReturnStmt>()) {
+        if (s->e)
+            emit_expr(s->e);
+
+        emit_loc(stmt);
+        emit_epilogue();
+        return;
+    }
+
+    if (auto s = stmt.cast<DeclStmt>()) {
+        // Unrolled loops repeat their declarations, so each local gets one slot
+        if (fn.locals.contains(s->ident))
+            return;
+        fn.locals[s->ident] = fn.stack_size - frame_size;
+        fn.stack_size += 8;
+        ASSERT(fn.stack_size <= frame_size);
+        return;
+    }
+
+    ASSERT(!"Unknown stmt kind");
+}
+
+// Allocates the locals declared within stmt, so that a block emitted out of line keeps the frame
+// layout of source order
+void Codegen::declare_locals(const StmtVal& stmt) {
+    if (auto s = stmt.cast<CompoundStmt>()) {
+        for (auto& i : s->items) {
+            declare_locals(i);
+        }
+    } else if (auto s = stmt.cast<IfStmt>()) {
+        declare_locals(s->then_);
+        if (s->else_)
+            declare_locals(s->else_);
+    } else if (auto s = stmt.cast<LoopStmt>()) {
+        declare_locals(s->then);
+    } else if (stmt.cast<DeclStmt>()) {
+        emit_stmt(stmt);
+    }
+}
+
+void Codegen::emit_function(const StmtVal& body) {
+    if (options.debug_info != DebugInfoLevel::None)
+        print(".file 1 \"stdin\"\n");
+    print(".text\n");
+    if (options.target == TargetOs::Linux) {
+        print(".globl _start\n");
+        print(".align 4\n");
+        print("_start:\n");
+        print("bl main\n");
+        emit_constant("x8", 93);  // exit
+        print("svc 0\n");
+    }
+
+    const std::string_view main_symbol = options.target == TargetOs::Darwin ? "_main" : "main";
+    print(".globl {}\n", main_symbol);
+    print(".align 4\n");
+    print("{}:\n", main_symbol);
+
+    print("stp fp, lr, [sp, -16]!\n");
+    print("mov fp, sp\n");
+    print("sub sp, sp, {}\n", frame_size);
+
+    fn = Function{};
+    cold_blocks.clear();
+    emit_stmt(body);
+
+    if (falls_through(body))
+        emit_epilogue();
+
+    // Emitting a cold block may queue more. None of them falls through.
+    for (std::size_t k = 0; k < cold_blocks.size(); k++) {
+        const auto [label, block] = cold_blocks[k];
+        print("{}:\n", label);
+        emit_stmt(*block);
+    }
+
+    if (options.cpu)
+        out = schedule(out, *options.cpu);
+}
+
+// Tears down the frame record and returns. A tail call would emit the same teardown followed
+// by a branch to the callee.
+void Codegen::emit_epilogue() {
+    print("mov sp, fp\n");
+    print("ldp fp, lr, [sp], 16\n");
+    print("ret\n");
+}
@@ -0,0 +1,111 @@
+// This file is part of the smolcc project
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iterator>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <fmt/core.h>
+
+#include "alloc_trace.h"
+#include "parser.h"
+#include "scheduler.h"
+
+struct VectorLoopStmt;
+struct VectorOperands;
+
+enum class DebugInfoLevel {
+    None,            // -g0
+    LineTablesOnly,  // -gline-tables-only: .loc only where the location changes
+    Full,            // -g: .loc for every expression
+};
+
+enum class TargetOs {
+    Darwin,  // Mach-O, entered at _main through libSystem
+    Linux,   // ELF, freestanding: _start calls main and exits with its result
+};
+
+struct CodegenOptions {
+    TargetOs target = TargetOs::Darwin;
+    DebugInfoLevel debug_info = DebugInfoLevel::Full;
+    std::optional<Cpu> cpu;  // -mcpu=: schedule for this core
+};
+
+struct Function {
+    // Offsets from fp
+    std::map<std::string, int> locals;
+    int stack_size = 0;
+};
+
+// Generates the assembly for one compilation. All state lives in the instance, so separate
+// compilations may run concurrently on different threads.
+class Codegen {
+public:
+    explicit Codegen(CodegenOptions options)
+            : options(options) {}
+
+    void emit_function(const StmtVal& body);
+
+    const std::string& output() const { return out; }
+
+private:
+    template<typename... Ts>
+    void print(fmt::format_string<Ts...> format, Ts&&... args) {
+        TRACE_ALLOCATIONS(CodegenPrint);
+        fmt::format_to(std::back_inserter(out), format, std::forward<Ts>(args)...);
+    }
+
+    template<typename T>
+    void emit_loc(const T& x) {
+        const Location& loc = x->loc;
+        switch (options.debug_info) {
+        case DebugInfoLevel::None:
+            return;
+        case DebugInfoLevel::LineTablesOnly:
+            if (last_loc && last_loc->file == loc.file && last_loc->line == loc.line && last_loc->col == loc.col)
+                return;
+            last_loc = loc;
+            break;
+        case DebugInfoLevel::Full:
+            break;
+        }
+        print(".loc {} {} {}\n", loc.file, loc.line, loc.col);
+    }
+
+    int new_label() { return next_label++; }
+
+    void emit_constant(std::string_view reg, std::uint64_t value);
+    void emit_addr(const ExprVal& expr);
+    void emit_scaled_addsub(bool is_add, std::string_view base, std::string_view index, std::size_t scale);
+    void emit_addsub(BinOpExpr* e, std::string_view lhs, std::string_view rhs);
+    void emit_divmod_by_constant(bool is_modulo, std::int64_t divisor);
+    void emit_expr(const ExprVal& expr);
+    void emit_assign(AssignExpr* e, bool value_used);
+    void emit_discarded(const ExprVal& expr);
+    void emit_compare(BinOpExpr* e);
+    std::string_view emit_condition(const ExprVal& expr);
+    void emit_select(std::string_view cc, const ExprVal& if_true, const ExprVal& if_false);
+    bool emit_if_conversion(IfStmt* s);
+    void emit_branch(const ExprVal& cond, bool when, std::string_view label);
+    std::string emit_vector_expr(const ExprVal& expr, const VectorOperands& ops, int depth);
+    void emit_vector_loop(VectorLoopStmt* s);
+    void emit_stmt(const StmtVal& stmt);
+    void declare_locals(const StmtVal& stmt);
+    void emit_epilogue();
+
+    CodegenOptions options;
+    Function fn;
+    std::optional<Location> last_loc;
+    // Unlikely blocks, emitted after the function body: (label, block)
+    std::vector<std::pair<std::string, const StmtVal*>> cold_blocks;
+    int next_label = 1;
+    std::string out;
+};
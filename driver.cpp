@@ -0,0 +1,209 @@
+// This file is part of the smolcc project
+// SPDX-License-Identifier: MIT
+
+#include "driver.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <system_error>
+#include <thread>
+
+#ifdef __APPLE__
+#include <mach-o/dyld.h>
+#endif
+
+#include <fmt/core.h>
+
+#include "assert.h"
+#include "cache.h"
+#include "lexer.h"
+#include "optimizer.h"
+#include "parser.h"
+#include "timing.h"
+
+// The running executable, wherever it was found: argv[0] may be a bare name looked up on $PATH
+static std::optional<std::filesystem::path> executable_path() {
+#ifdef __APPLE__
+    std::uint32_t size = 0;
+    _NSGetExecutablePath(nullptr, &size);
+    std::string path(size, '\0');
+    if (_NSGetExecutablePath(path.data(), &size) != 0)
+        return std::nullopt;
+    path.resize(path.find('\0'));
+    return std::filesystem::path{path};
+#else
+    std::error_code ec;
+    std::filesystem::path path = std::filesystem::read_symlink("/proc/self/exe", ec);
+    if (ec)
+        return std::nullopt;
+    return path;
+#endif
+}
+
+std::string compiler_stamp() {
+    const std::optional<std::filesystem::path> path = executable_path();
+    if (!path)
+        return {};
+
+    std::error_code ec;
+    const auto size = std::filesystem::file_size(*path, ec);
+    if (ec)
+        return {};
+    const auto time = std::filesystem::last_write_time(*path, ec);
+    if (ec)
+        return {};
+    return fmt::format("smolcc {} {}\n", size, time.time_since_epoch().count());
+}
+
+Invocation parse_invocation(std::string_view stamp, const std::vector<std::string_view>& args) {
+    ASSERT(!args.empty());
+    PhaseTimer timer{Phase::Input};
+
+    Invocation inv;
+    inv.key = stamp;
+    for (std::size_t i = 0; i < args.size() - 1; i++) {
+        const std::string_view arg = args[i];
+        if (arg.starts_with("-fcache-dir=")) {
+            // Without a stamp, outputs from another build could not be told apart
+            if (!stamp.empty())
+                inv.cache_dir = arg.substr(12);
+            continue;
+        }
+        // Reporting options do not change the output
+        if (arg == "-ftime-report" || arg == "-ftime-report=json")
+            continue;
+
+        inv.key += fmt::format("{}:{}\n", arg.size(), arg);
+        if (arg.starts_with("--target=")) {
+            const std::string_view triple = arg.substr(9);
+            ASSERT(triple.starts_with("aarch64-") || triple.starts_with("arm64-"));
+            if (triple.find("linux") != std::string_view::npos) {
+                inv.options.target = TargetOs::Linux;
+            } else if (triple.find("darwin") != std::string_view::npos || triple.find("macos") != std::string_view::npos) {
+                inv.options.target = TargetOs::Darwin;
+            } else {
+                ASSERT(!"Unknown target");
+            }
+        } else if (arg == "-O0") {
+            inv.optimize = false;
+        } else if (arg == "-O1") {
+            inv.optimize = true;
+        } else if (arg == "-g0") {
+            inv.options.debug_info = DebugInfoLevel::None;
+        } else if (arg == "-gline-tables-only") {
+            inv.options.debug_info = DebugInfoLevel::LineTablesOnly;
+        } else if (arg == "-g") {
+            inv.options.debug_info = DebugInfoLevel::Full;
+        } else if (arg.starts_with("-mcpu=")) {
+            inv.options.cpu = parse_cpu(arg.substr(6));
+            ASSERT(inv.options.cpu);
+        } else {
+            ASSERT(!"Unknown option");
+        }
+    }
+
+    inv.source = args.back();
+    inv.key += inv.source;
+    return inv;
+}
+
+std::string compile(const Invocation& inv) {
+    std::optional<CompileCache> cache;
+    if (inv.cache_dir) {
+        PhaseTimer timer{Phase::Cache};
+        cache.emplace(*inv.cache_dir);
+        if (auto output = cache->lookup(inv.key))
+            return *output;
+    }
+
+    std::string output = compile_uncached(inv);
+    if (cache) {
+        PhaseTimer timer{Phase::Cache};
+        cache->store(inv.key, output);
+    }
+    return output;
+}
+
+std::string compile_uncached(const Invocation& inv) {
+    StmtVal s;
+    {
+        PhaseTimer timer{Phase::Parse};
+        Parser p{TokenStream{CharStream{1, inv.source}}};
+        s = p.statement();
+    }
+    {
+        PhaseTimer timer{Phase::Optimize};
+        if (inv.optimize)
+            optimize(s);
+    }
+
+    Codegen codegen{inv.options};
+    {
+        PhaseTimer timer{Phase::Codegen};
+        codegen.emit_function(s);
+    }
+    return codegen.output();
+}
+
+std::vector<std::filesystem::path> expand_response_files(const std::vector<std::string_view>& args) {
+    std::vector<std::filesystem::path> result;
+    for (std::string_view arg : args) {
+        if (!arg.starts_with('@')) {
+            result.emplace_back(arg);
+            continue;
+        }
+
+        std::ifstream file{std::filesystem::path{arg.substr(1)}};
+        ASSERT(file);
+        std::string line;
+        while (std::getline(file, line)) {
+            if (!line.empty())
+                result.emplace_back(line);
+        }
+    }
+    return result;
+}
+
+static std::string read_file(const std::filesystem::path& path) {
+    PhaseTimer timer{Phase::Input};
+    std::ifstream file{path, std::ios::binary};
+    ASSERT(file);
+    return std::string{std::istreambuf_iterator<char>{file}, {}};
+}
+
+void compile_batch(std::string_view stamp, const std::vector<std::string_view>& options, const std::vector<std::filesystem::path>& inputs) {
+    // Checked before any output is written, as an input named foo.s would be overwritten by its own
+    // output
+    for (const std::filesystem::path& input : inputs)
+        ASSERT(input.extension() != ".s" && "batch inputs must not end in .s");
+
+    // Compiles are independent and share nothing, so each worker simply claims the next input
+    // until none are left. Slow inputs cannot strand work behind them.
+    std::atomic<std::size_t> next = 0;
+    auto worker = [&] {
+        while (true) {
+            const std::size_t i = next++;
+            if (i >= inputs.size())
+                return;
+
+            const std::string source = read_file(inputs[i]);
+            std::vector<std::string_view> args = options;
+            args.push_back(source);
+            const std::string output = compile(parse_invocation(stamp, args));
+
+            PhaseTimer timer{Phase::Output};
+            std::filesystem::path out_path = inputs[i];
+            out_path.replace_extension(".s");
+            std::ofstream out{out_path, std::ios::binary};
+            ASSERT(out << output);
+        }
+    };
+
+    std::vector<std::jthread> workers;
+    const std::size_t count = std::min<std::size_t>(std::max(1u, std::thread::hardware_concurrency()), inputs.size());
+    for (std::size_t i = 0; i < count; i++)
+        workers.emplace_back(worker);
+}
@@ -0,0 +1,42 @@
+// This file is part of the smolcc project
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "codegen.h"
+
+// One compile, as given on the command line: [options] source
+struct Invocation {
+    CodegenOptions options;
+    std::optional<std::filesystem::path> cache_dir;
+    // -O0 skips the AST optimizer
+    bool optimize = true;
+    // Everything that determines the output
+    std::string key;
+    std::string source;
+};
+
+// Identifies this build of the compiler, so that rebuilding it invalidates cached outputs. Empty if
+// the running executable cannot be found, in which case -fcache-dir is ignored.
+std::string compiler_stamp();
+
+Invocation parse_invocation(std::string_view stamp, const std::vector<std::string_view>& args);
+
+// Compiles to assembly, consulting and filling the cache directory if one was given
+std::string compile(const Invocation& inv);
+
+// Compiles to assembly, ignoring the cache directory
+std::string compile_uncached(const Invocation& inv);
+
+// Replaces each @file argument with the paths it lists, one per line
+std::vector<std::filesystem::path> expand_response_files(const std::vector<std::string_view>& args);
+
+// Compiles each input file to a .s file beside it, on one worker per hardware thread. Inputs ending
+// in .s are rejected.
+void compile_batch(std::string_view stamp, const std::vector<std::string_view>& options, const std::vector<std::filesystem::path>& inputs);
@@ -0,0 +1,350 @@
+// This file is part of the smolcc project
+// SPDX-License-Identifier: MIT
+
+#include "fuzzer.h"
+
+#include <algorithm>
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <random>
+
+#include <fmt/core.h>
+
+#include "assert.h"
+#include "driver.h"
+#include "interpreter.h"
+#include "lexer.h"
+#include "parser.h"
+#include "simulator.h"
+
+namespace {
+
+class Generator {
+public:
+    Generator(std::uint64_t seed, const GeneratorOptions& options)
+            : rng(seed), options(options), budget(options.size) {}
+
+    std::string program();
+
+private:
+    // A loop counter in use, and the largest value it takes inside the body
+    struct ActiveLoop {
+        int counter;
+        std::int64_t max;
+    };
+
+    std::int64_t uniform(std::int64_t lo, std::int64_t hi) { return std::uniform_int_distribution<std::int64_t>{lo, hi}(rng); }
+    bool chance(int percent) { return uniform(0, 99) < percent; }
+
+    std::string constant();
+    std::string variable();
+    std::string element(int depth);
+    std::string divisor(int depth);
+    std::string expression(int depth);
+    std::string assignment(int depth);
+    std::string statement(int depth);
+    std::string block(int depth);
+    std::string update(int counter, std::int64_t step);
+    std::string loop(int depth);
+
+    std::mt19937_64 rng;
+    GeneratorOptions options;
+    int budget;
+
+    int scalars = 0;
+    int arrays = 0;
+    int length = 0;
+    int counters = 0;
+    std::vector<ActiveLoop> loops;
+    std::vector<std::string> temporaries;  // Declared in enclosing blocks
+    int next_temporary = 0;
+};
+
+}  // namespace
+
+// The frame holds 32 locals, and the optimizer may add its own
+static constexpr int max_array_slots = 12;
+static constexpr int max_temporaries = 4;
+
+std::string Generator::constant() {
+    if (chance(85))
+        return fmt::format("{}", uniform(0, 100));
+    if (chance(50))
+        return fmt::format("(0 - {})", uniform(1, 100));
+    // Wide constants exercise materialisation
+    static constexpr std::int64_t wide[]{65535, 65536, 4294901760, 4294967295, 81985529216486895, 1311768467463790320};
+    return fmt::format("{}", wide[uniform(0, std::size(wide) - 1)]);
+}
+
+std::string Generator::variable() {
+    const std::int64_t pick = uniform(0, scalars + counters + static_cast<std::int64_t>(temporaries.size()) - 1);
+    if (pick < scalars)
+        return fmt::format("v{}", pick);
+    if (pick < scalars + counters)
+        return fmt::format("i{}", pick - scalars);
+    return temporaries[pick - scalars - counters];
+}
+
+// An array element, always in bounds
+std::string Generator::element(int depth) {
+    const std::int64_t array = uniform(0, arrays - 1);
+    std::vector<int> counters_in_bounds;
+    for (const ActiveLoop& l : loops) {
+        if (l.max < length)
+            counters_in_bounds.push_back(l.counter);
+    }
+
+    std::string index;
+    if (!counters_in_bounds.empty() && chance(50))
+        index = fmt::format("i{}", counters_in_bounds[uniform(0, counters_in_bounds.size() - 1)]);
+    else if (depth == 0 || chance(50))
+        index = fmt::format("{}", uniform(0, length - 1));
+    else
+        index = fmt::format("({} % {} + {}) % {}", expression(depth - 1), length, length, length);
+    return fmt::format("*(&a{}_0 + {})", array, index);
+}
+
+// Positive, or a negative constant other than -1, so no quotient traps or overflows
+std::string Generator::divisor(int depth) {
+    if (chance(40))
+        return fmt::format("{}", uniform(1, 12));
+    if (chance(30))
+        return fmt::format("(0 - {})", uniform(2, 12));
+    return fmt::format("(({} & 7) + 1)", expression(depth));
+}
+
+std::string Generator::expression(int depth) {
+    if (depth == 0 || chance(25)) {
+        const std::int64_t leaf = uniform(0, 9);
+        if (leaf < 3)
+            return constant();
+        if (leaf < 8 || !arrays)
+            return variable();
+        return element(0);
+    }
+
+    static constexpr std::string_view binary[]{"+", "-", "*", "&", "^", "|", "<", ">", "<=", ">=", "==", "!=", "&&", "||"};
+    switch (uniform(0, 9)) {
+    case 0:
+        return fmt::format("({} / {})", expression(depth - 1), divisor(depth - 1));
+    case 1:
+        return fmt::format("({} % {})", expression(depth - 1), divisor(depth - 1));
+    case 2:
+        return fmt::format("{}({})", chance(80) ? "-" : "+", expression(depth - 1));
+    case 3:
+        if (arrays && chance(50))
+            return element(depth);
+    {
+        const std::string v = variable();
+        return chance(50) ? fmt::format("*&{}", v) : fmt::format("*(&{} + 0)", v);
+    }
+    default:
+        return fmt::format("({} {} {})", expression(depth - 1), binary[uniform(0, std::size(binary) - 1)], expression(depth - 1));
+    }
+}
+
+// Loop counters are only ever written by their loops
+std::string Generator::assignment(int depth) {
+    std::string target;
+    if (arrays && chance(30)) {
+        target = element(depth);
+    } else {
+        const std::int64_t pick = uniform(0, scalars + static_cast<std::int64_t>(temporaries.size()) - 1);
+        target = pick < scalars ? fmt::format("v{}", pick) : temporaries[pick - scalars];
+    }
+    return fmt::format("{} = {}", target, expression(depth));
+}
+
+std::string Generator::block(int depth) {
+    const std::size_t outer_temporaries = temporaries.size();
+    std::string out = "{ ";
+    if (next_temporary < max_temporaries && chance(25)) {
+        std::string name = fmt::format("t{}", next_temporary++);
+        out += fmt::format("int {}; {} = {}; ", name, name, expression(depth));
+        temporaries.push_back(std::move(name));
+    }
+    const std::int64_t count = uniform(1, 3);
+    for (std::int64_t i = 0; i < count && budget > 0; i++)
+        out += statement(depth) + " ";
+    temporaries.resize(outer_temporaries);
+    return out + "}";
+}
+
+// `i = i + step`, sometimes written with a negated constant that folding turns negative
+std::string Generator::update(int counter, std::int64_t step) {
+    const std::int64_t magnitude = step < 0 ? -step : step;
+    const std::string_view same = step < 0 ? "-" : "+";
+    const std::string_view opposite = step < 0 ? "+" : "-";
+    switch (uniform(0, 2)) {
+    case 0:
+        return fmt::format("i{0} = i{0} {1} {2}", counter, same, magnitude);
+    case 1:
+        return fmt::format("i{0} = i{0} {1} -{2}", counter, opposite, magnitude);
+    default:
+        return fmt::format("i{0} = i{0} {1} (0 - {2})", counter, opposite, magnitude);
+    }
+}
+
+std::string Generator::loop(int depth) {
+    const int counter = static_cast<int>(loops.size());
+    const std::int64_t step = chance(70) ? 1 : uniform(2, 3);
+    std::int64_t max;
+    std::string bound;
+    if (chance(70)) {
+        const std::int64_t n = chance(50) ? length : uniform(0, 6);
+        bound = fmt::format("{}", n);
+        max = n - 1;
+    } else {
+        // A bound the body may change, still at most 7
+        bound = fmt::format("{} % 8", variable());
+        max = 6;
+    }
+
+    std::string out;
+    if (arrays >= 2 && chance(25)) {
+        // The shape the vectoriser looks for
+        static constexpr std::string_view ops[]{"+", "-", "&", "^", "|"};
+        loops.push_back({counter, length - 1});
+        const std::int64_t dst = uniform(0, arrays - 1);
+        const std::int64_t src = uniform(0, arrays - 1);
+        const std::string rhs = chance(50) ? constant() : fmt::format("v{}", uniform(0, scalars - 1));
+        out = fmt::format("for (i{0} = 0; i{0} < {1}; i{0} = i{0} + 1) *(&a{2}_0 + i{0}) = *(&a{3}_0 + i{0}) {4} {5};", counter, length, dst, src, ops[uniform(0, std::size(ops) - 1)], rhs);
+    } else if (chance(25)) {
+        // Counting down to zero
+        const std::int64_t start = chance(50) ? length - 1 : uniform(0, 6);
+        loops.push_back({counter, start});
+        out = fmt::format("for (i{0} = {1}; i{0} >= 0; {2}) {3}", counter, start, update(counter, -step), block(depth - 1));
+    } else if (chance(75)) {
+        loops.push_back({counter, max});
+        out = fmt::format("for (i{0} = 0; i{0} < {1}; {2}) {3}", counter, bound, update(counter, step), block(depth - 1));
+    } else {
+        loops.push_back({counter, max});
+        std::string body = block(depth - 1);
+        body.insert(body.size() - 1, update(counter, step) + "; ");
+        out = fmt::format("i{0} = 0; while (i{0} < {1}) {2}", counter, bound, body);
+    }
+    loops.pop_back();
+    return out;
+}
+
+std::string Generator::statement(int depth) {
+    budget--;
+    const std::int64_t kind = uniform(0, 99);
+    if (depth > 0 && kind < 20 && static_cast<int>(loops.size()) < counters)
+        return loop(depth);
+    if (depth > 0 && kind < 40) {
+        std::string out = fmt::format("if ({}) {}", expression(options.depth), block(depth - 1));
+        if (chance(50))
+            out += fmt::format(" else {}", block(depth - 1));
+        return out;
+    }
+    if (kind < 45)
+        return fmt::format("if ({}) return {};", expression(options.depth), expression(options.depth));
+    if (kind < 52)
+        return fmt::format("{} {} ({});", expression(options.depth), chance(50) ? "&&" : "||", assignment(options.depth));
+    return assignment(options.depth) + ";";
+}
+
+std::string Generator::program() {
+    scalars = static_cast<int>(uniform(2, 6));
+    arrays = static_cast<int>(uniform(0, 3));
+    length = static_cast<int>(uniform(2, 8));
+    arrays = std::min<int>(arrays, max_array_slots / length);
+    counters = options.depth;
+
+    std::string decls;
+    std::string inits;
+    for (int i = 0; i < scalars; i++) {
+        decls += fmt::format("int v{}; ", i);
+        inits += fmt::format("v{} = {}; ", i, constant());
+    }
+    for (int i = 0; i < counters; i++) {
+        decls += fmt::format("int i{}; ", i);
+        inits += fmt::format("i{} = 0; ", i);
+    }
+    for (int a = 0; a < arrays; a++) {
+        for (int i = 0; i < length; i++) {
+            decls += fmt::format("int a{}_{}; ", a, i);
+            inits += fmt::format("a{}_{} = {}; ", a, i, constant());
+        }
+    }
+
+    std::string body;
+    while (budget > 0)
+        body += statement(options.depth) + " ";
+    return fmt::format("{{ {}{}{}return {}; }}", decls, inits, body, expression(options.depth));
+}
+
+std::string generate_program(std::uint64_t seed, const GeneratorOptions& options) {
+    ASSERT(options.size >= 0 && options.depth >= 0);
+    return Generator{seed, options}.program();
+}
+
+static std::uint64_t parse_number(std::string_view s) {
+    std::uint64_t value;
+    const auto [end, ec] = std::from_chars(s.data(), s.data() + s.size(), value);
+    ASSERT(!s.empty() && ec == std::errc{} && end == s.data() + s.size());
+    return value;
+}
+
+FuzzOptions parse_fuzz_options(const std::vector<std::string_view>& args) {
+    FuzzOptions options;
+    for (std::string_view arg : args) {
+        if (arg.starts_with("-seed=")) {
+            options.seed = parse_number(arg.substr(6));
+        } else if (arg.starts_with("-count=")) {
+            options.count = parse_number(arg.substr(7));
+        } else if (arg.starts_with("-size=")) {
+            options.generator.size = static_cast<int>(parse_number(arg.substr(6)));
+        } else if (arg.starts_with("-depth=")) {
+            options.generator.depth = static_cast<int>(parse_number(arg.substr(7)));
+        } else {
+            ASSERT(!"Unknown fuzz option");
+        }
+    }
+    return options;
+}
+
+std::size_t fuzz(std::string_view stamp, const FuzzOptions& options) {
+    static const std::vector<std::vector<std::string_view>> configurations{
+            {"-O0"},
+            {"-O1"},
+            {"-O0", "-mcpu=apple-m1"},
+            {"-O1", "-mcpu=cortex-a76"},
+            {"-O1", "-mcpu=neoverse-n1"},
+            {"-O1", "-mcpu=apple-m1"},
+            {"-O1", "--target=aarch64-linux-gnu"},
+    };
+
+    std::size_t mismatches = 0;
+    fmt::print("seed,options,source_bytes,compile_us,asm_bytes,instructions,cycles,result\n");
+    for (std::uint64_t seed = options.seed; seed < options.seed + options.count; seed++) {
+        const std::string source = generate_program(seed, options.generator);
+
+        Parser p{TokenStream{CharStream{1, source}}};
+        const std::int64_t expected = interpret(p.statement());
+
+        for (const std::vector<std::string_view>& config : configurations) {
+            std::vector<std::string_view> args = config;
+            args.push_back(source);
+            std::string options_text;
+            for (std::string_view option : config)
+                options_text += fmt::format("{}{}", options_text.empty() ? "" : " ", option);
+
+            const auto start = std::chrono::steady_clock::now();
+            const std::string output = compile(parse_invocation(stamp, args));
+            const auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start);
+
+            const SimulationResult result = simulate(output);
+            const auto got = static_cast<std::int64_t>(result.exit_code);
+            fmt::print("{},{},{},{},{},{},{},{}\n", seed, options_text, source.size(), elapsed.count(), output.size(), result.stats.instructions, result.stats.cycles, got == expected ? "ok" : "MISMATCH");
+            if (got != expected) {
+                mismatches++;
+                fmt::print(stderr, "seed {} with {}: expected {}, got {}\n{}\n", seed, options_text, expected, got, source);
+            }
+        }
+        std::fflush(stdout);
+    }
+    return mismatches;
+}
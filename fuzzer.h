@@ -0,0 +1,39 @@
+// This file is part of the smolcc project
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct GeneratorOptions {
+    // Statements per program, and how deep statements and expressions nest
+    int size = 16;
+    int depth = 3;
+};
+
+// A random program in the subset smolcc accepts: scalar locals, runs of consecutive locals indexed
+// through pointers, nested arithmetic, logical and comparison expressions, if/else, bounded for and
+// while loops, and early returns. Every loop terminates, every pointer stays inside the frame and
+// no division can trap, so the interpreter's result is the reference. The same seed always gives
+// the same program.
+std::string generate_program(std::uint64_t seed, const GeneratorOptions& options);
+
+struct FuzzOptions {
+    std::uint64_t seed = 1;
+    std::size_t count = 100;
+    GeneratorOptions generator;
+};
+
+// Parses --fuzz's arguments: -seed=N -count=N -size=N -depth=N
+FuzzOptions parse_fuzz_options(const std::vector<std::string_view>& args);
+
+// Generates `count` programs from consecutive seeds and compiles each one in every configuration
+// (-O0 and -O1, each scheduling model, both targets). Each result is run on the simulator and
+// checked against the interpreter. Prints one CSV row per program and configuration, with compile
+// time, assembly size and dynamic counts, and reports mismatches with their source on stderr.
+// Returns the number of mismatches.
+std::size_t fuzz(std::string_view stamp, const FuzzOptions& options);
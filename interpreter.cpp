@@ -0,0 +1,216 @@
+// This file is part of the smolcc project
+// SPDX-License-Identifier: MIT
+
+#include "interpreter.h"
+
+#include <cstddef>
+#include <limits>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "assert.h"
+
+namespace {
+
+// Pointers hold a frame slot index
+struct Value {
+    std::int64_t v;
+    bool is_pointer = false;
+};
+
+class Interpreter {
+public:
+    explicit Interpreter(const StmtVal& body) { assign_slots(body); }
+
+    std::int64_t run(const StmtVal& body);
+
+private:
+    void assign_slots(const StmtVal& stmt);
+
+    // Returns true once a return statement has run
+    bool exec(const StmtVal& stmt);
+    Value eval(const ExprVal& expr);
+    std::int64_t& lvalue(const ExprVal& expr);
+    std::int64_t& slot(std::int64_t index);
+
+    std::unordered_map<std::string, std::size_t> slots;
+    std::vector<std::int64_t> frame;
+    std::int64_t result = 0;
+    std::uint64_t steps = 0;
+};
+
+}  // namespace
+
+// Generous enough for any terminating test program
+static constexpr std::uint64_t step_limit = std::uint64_t{1} << 28;
+
+static std::int64_t wrap(std::uint64_t v) {
+    return static_cast<std::int64_t>(v);
+}
+
+// sdiv semantics: division by zero gives zero, and the one overflowing quotient wraps
+static std::int64_t divide(std::int64_t a, std::int64_t b) {
+    if (b == 0)
+        return 0;
+    if (a == std::numeric_limits<std::int64_t>::min() && b == -1)
+        return a;
+    return a / b;
+}
+
+void Interpreter::assign_slots(const StmtVal& stmt) {
+    if (auto s = stmt.cast<CompoundStmt>()) {
+        for (const StmtVal& item : s->items)
+            assign_slots(item);
+    } else if (auto s = stmt.cast<IfStmt>()) {
+        assign_slots(s->then_);
+        if (s->else_)
+            assign_slots(s->else_);
+    } else if (auto s = stmt.cast<LoopStmt>()) {
+        assign_slots(s->then);
+    } else if (auto s = stmt.cast<DeclStmt>()) {
+        if (slots.emplace(s->ident, frame.size()).second)
+            frame.push_back(0);
+    }
+}
+
+std::int64_t& Interpreter::slot(std::int64_t index) {
+    ASSERT(index >= 0 && static_cast<std::size_t>(index) < frame.size());
+    return frame[index];
+}
+
+std::int64_t& Interpreter::lvalue(const ExprVal& expr) {
+    if (auto e = expr.cast<VariableExpr>()) {
+        const auto it = slots.find(e->ident);
+        ASSERT(it != slots.end());
+        return frame[it->second];
+    }
+    if (auto e = expr.cast<UnOpExpr>(); e && e->op == UnOpKind::Dereference) {
+        const Value p = eval(e->e);
+        ASSERT(p.is_pointer);
+        return slot(p.v);
+    }
+    ASSERT(!"Not an lvalue");
+    return frame[0];
+}
+
+Value Interpreter::eval(const ExprVal& expr) {
+    ASSERT(++steps < step_limit);
+
+    if (auto e = expr.cast<IntegerConstantExpr>())
+        return {wrap(e->value)};
+
+    if (expr.cast<VariableExpr>())
+        return {lvalue(expr)};
+
+    if (auto e = expr.cast<UnOpExpr>()) {
+        switch (e->op) {
+        case UnOpKind::AddressOf: {
+            std::int64_t& target = lvalue(e->e);
+            return {&target - frame.data(), true};
+        }
+        case UnOpKind::Dereference:
+            return {lvalue(expr)};
+        case UnOpKind::Posate:
+            return eval(e->e);
+        case UnOpKind::Negate:
+            return {wrap(0 - static_cast<std::uint64_t>(eval(e->e).v))};
+        }
+    }
+
+    if (auto e = expr.cast<AssignExpr>()) {
+        const Value v = eval(e->rhs);
+        lvalue(e->lhs) = v.v;
+        return v;
+    }
+
+    auto e = expr.cast<BinOpExpr>();
+    ASSERT(e);
+
+    if (e->op == BinOpKind::LogicalAnd)
+        return {eval(e->lhs).v && eval(e->rhs).v};
+    if (e->op == BinOpKind::LogicalOr)
+        return {eval(e->lhs).v || eval(e->rhs).v};
+
+    const Value l = eval(e->lhs);
+    const Value r = eval(e->rhs);
+    const auto a = static_cast<std::uint64_t>(l.v);
+    const auto b = static_cast<std::uint64_t>(r.v);
+    switch (e->op) {
+    case BinOpKind::Add:
+        return {wrap(a + b), l.is_pointer || r.is_pointer};
+    case BinOpKind::Subtract:
+        return {wrap(a - b), l.is_pointer && !r.is_pointer};
+    case BinOpKind::Multiply:
+        return {wrap(a * b)};
+    case BinOpKind::Divide:
+        return {divide(l.v, r.v)};
+    case BinOpKind::Modulo:
+        return {wrap(a - static_cast<std::uint64_t>(divide(l.v, r.v)) * b)};
+    case BinOpKind::LShift:
+        return {wrap(a << (b & 63))};
+    case BinOpKind::RShift:
+        return {l.v >> (b & 63)};
+    case BinOpKind::LessThan:
+        return {l.v < r.v};
+    case BinOpKind::GreaterThan:
+        return {l.v > r.v};
+    case BinOpKind::LessThanEqual:
+        return {l.v <= r.v};
+    case BinOpKind::GreaterThanEqual:
+        return {l.v >= r.v};
+    case BinOpKind::Equal:
+        return {l.v == r.v};
+    case BinOpKind::NotEqual:
+        return {l.v != r.v};
+    case BinOpKind::BitAnd:
+        return {l.v & r.v};
+    case BinOpKind::BitXor:
+        return {l.v ^ r.v};
+    case BinOpKind::BitOr:
+        return {l.v | r.v};
+    default:
+        ASSERT(!"Unknown binary operator");
+        return {0};
+    }
+}
+
+bool Interpreter::exec(const StmtVal& stmt) {
+    if (auto s = stmt.cast<CompoundStmt>()) {
+        for (const StmtVal& item : s->items) {
+            if (exec(item))
+                return true;
+        }
+    } else if (auto s = stmt.cast<ExprStmt>()) {
+        if (s->e)
+            result = eval(s->e).v;
+    } else if (auto s = stmt.cast<IfStmt>()) {
+        if (eval(s->cond).v)
+            return exec(s->then_);
+        if (s->else_)
+            return exec(s->else_);
+    } else if (auto s = stmt.cast<LoopStmt>()) {
+        if (s->init)
+            eval(s->init);
+        while (!s->cond || eval(s->cond).v) {
+            ASSERT(++steps < step_limit);
+            if (exec(s->then))
+                return true;
+            if (s->incr)
+                eval(s->incr);
+        }
+    } else if (auto s = stmt.cast<ReturnStmt>()) {
+        result = s->e ? eval(s->e).v : 0;
+        return true;
+    }
+    return false;
+}
+
+std::int64_t Interpreter::run(const StmtVal& body) {
+    exec(body);
+    return result;
+}
+
+std::int64_t interpret(const StmtVal& body) {
+    return Interpreter{body}.run(body);
+}
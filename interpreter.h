@@ -0,0 +1,15 @@
+// This file is part of the smolcc project
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <cstdint>
+
+#include "parser.h"
+
+// Evaluates a function body straight from the AST, as the reference for differential testing.
+// Locals occupy consecutive 8-byte slots in declaration order, as in generated code, so pointer
+// arithmetic between neighbouring locals is defined; dereferencing outside the frame asserts.
+// Arithmetic wraps. The result is the returned value, or else the value of the last expression
+// statement run.
+std::int64_t interpret(const StmtVal& body);
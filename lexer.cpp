@@ -6,6 +6,7 @@
 #include <optional>
 
 #include "assert.h"
+#include "timing.h"
 
 static bool isspace(std::optional<char> ch) {
     return ch == ' ' || ch == '\t' || ch == '\v' || ch == '\r' || ch == '\n';
@@ -20,6 +21,7 @@ static bool isidentifiernondigit(std::optional<char> ch) {
 }
 
 Token TokenStream::tok() {
+    PhaseTimer timer{Phase::Lex};
     while (inner.peek()) {
         while (isspace(inner.peek())) {
             inner.get();
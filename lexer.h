@@ -8,6 +8,8 @@
 #include <string>
 #include <string_view>
 
+#include "alloc_trace.h"
+
 using FileId = std::size_t;
 struct Location {
     Location() = default;
@@ -155,6 +157,7 @@ struct Token {
     }
 
     static Token Identifier(Location loc, std::string payload) {
+        TRACE_ALLOCATIONS(TokenIdentifier);
         Token result;
         result.kind = TokenKind::Identifier;
         result.loc = loc;
@@ -169,9 +172,10 @@ public:
             : inner(std::move(inner)) {}
 
     Token peek() {
-        if (current)
-            return *current;
-        return *(current = tok());
+        if (!current)
+            current = tok();
+        TRACE_ALLOCATIONS(TokenCopy);
+        return *current;
     }
 
     bool peek(PunctuatorKind punctuator) {
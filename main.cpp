@@ -1,296 +1,84 @@
 // This file is part of the smolcc project
 // SPDX-License-Identifier: MIT
 
-#include <cstddef>
-#include <cstdint>
-#include <exception>
-#include <map>
-#include <memory>
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
 #include <optional>
 #include <string>
-#include <utility>
+#include <string_view>
+#include <vector>
 
 #include <fmt/core.h>
 
+#include "alloc_trace.h"
 #include "assert.h"
-#include "lexer.h"
-#include "parser.h"
-
-static int iota() {
-    static int value = 1;
-    return value++;
-}
-
-struct Function {
-    StmtVal body;
-    std::map<std::string, int> locals;
-    int stack_size;
-};
-
-Function f{};
-
-template<typename T>
-void emit_loc(const T& x) {
-    fmt::print(".loc {} {} {}\n", x->loc.file, x->loc.line, x->loc.col);
-}
-
-void emit_addr(const ExprVal& expr);
-void emit_expr(const ExprVal& expr);
-void emit_stmt(const StmtVal& stmt);
-
-void emit_constant(std::string_view reg, std::uint64_t value) {
-    fmt::print("movz {}, {}\n", reg, value & 0xFFFF);
-    if ((value >> 16) & 0xFFFF)
-        fmt::print("movk {}, {}, lsl 16\n", reg, (value >> 16) & 0xFFFF);
-    if ((value >> 32) & 0xFFFF)
-        fmt::print("movk {}, {}, lsl 32\n", reg, (value >> 32) & 0xFFFF);
-    if ((value >> 48) & 0xFFFF)
-        fmt::print("movk {}, {}, lsl 48\n", reg, (value >> 48) & 0xFFFF);
-}
-
-void emit_addr(const ExprVal& expr) {
-    if (auto e = expr.cast<VariableExpr>()) {
-        fmt::print("add x0, fp, {}\n", f.locals[e->ident]);
-        return;
+#include "driver.h"
+#include "fuzzer.h"
+#include "server.h"
+#include "simulator.h"
+#include "timing.h"
+
+// -ftime-report prints per-phase times to stderr at exit, -ftime-report=json as a JSON object
+static std::optional<TimeReportFormat> time_report_format(const std::vector<std::string_view>& args) {
+    std::optional<TimeReportFormat> format;
+    for (std::string_view arg : args) {
+        if (arg == "-ftime-report")
+            format = TimeReportFormat::Table;
+        else if (arg == "-ftime-report=json")
+            format = TimeReportFormat::Json;
     }
-
-    if (auto e = expr.cast<UnOpExpr>()) {
-        switch (e->op) {
-        case UnOpKind::Dereference:
-            emit_expr(e->e);
-            return;
-        default:
-            ASSERT(!"Unknown unop kind");
-        }
-    }
-
-    ASSERT(!"!lvalue");
+    return format;
 }
 
-void emit_addsub(BinOpExpr* e) {
-    const bool is_add = e->op == BinOpKind::Add;
-    const TypeVal lt = e->lhs->type();
-    const TypeVal rt = e->rhs->type();
-    const bool lp = lt->is_pointer();
-    const bool rp = rt->is_pointer();
+// Usage: main [options] source
+//        main [options] --batch inputs...  (each compiled to a .s beside it; @file lists inputs)
+//        main --run [options] source  (simulates the program, reports dynamic counts, exits with its code)
+//        main --fuzz [-seed=N] [-count=N] [-size=N] [-depth=N]  (differential testing; exits 1 on a mismatch)
+//        main --serve
+int main(int argc, char* argv[]) {
+    ASSERT(argc >= 2);
 
-    if (lp && rp) {
-        ASSERT(!is_add && "pointer + pointer is invalid");
-        emit_constant("x2", lt.cast<PointerType>()->base->size());
-        fmt::print("sub x0, x1, x0\n");
-        fmt::print("udiv x0, x0, x2\n");
-        return;
-    } else if (lp && !rp) {
-        emit_constant("x2", lt.cast<PointerType>()->base->size());
-        fmt::print("{} x0, x0, x2, x1\n", is_add ? "madd" : "msub");  // x0 = x1 + x0 * x2
-        return;
-    } else if (!lp && rp) {
-        ASSERT(is_add && "integer - pointer is invalid");
-        emit_constant("x2", rt.cast<PointerType>()->base->size());
-        fmt::print("madd x0, x1, x2, x0\n");  // x0 = x0 + x1 * x2
-        return;
+    const std::string stamp = compiler_stamp();
+    if (std::string_view{argv[1]} == "--serve") {
+        std::ios::sync_with_stdio(false);
+        serve(stamp, std::cin, std::cout);
+        return 0;
     }
 
-    if (is_add) {
-        fmt::print("add x0, x1, x0\n");
+    const std::vector<std::string_view> args(argv + 1, argv + argc);
+    const std::optional<TimeReportFormat> time_format = time_report_format(args);
+    timing_enabled = time_format.has_value();
+#ifdef SMOLCC_TRACE_ALLOCATIONS
+    // Allocations are attributed to phases, so track them even without a time report
+    timing_enabled = true;
+#endif
+
+    int status = 0;
+    if (args.front() == "--run") {
+        const SimulationResult result = simulate(compile(parse_invocation(stamp, {args.begin() + 1, args.end()})));
+        fmt::print("exit code:      {}\n", result.exit_code & 0xff);
+        fmt::print("instructions:   {}\n", result.stats.instructions);
+        fmt::print("loads:          {}\n", result.stats.loads);
+        fmt::print("stores:         {}\n", result.stats.stores);
+        fmt::print("branches:       {} ({} taken)\n", result.stats.branches, result.stats.taken_branches);
+        fmt::print("cycles:         {}\n", result.stats.cycles);
+        status = static_cast<int>(result.exit_code & 0xff);
+    } else if (args.front() == "--fuzz") {
+        status = fuzz(stamp, parse_fuzz_options({args.begin() + 1, args.end()})) ? 1 : 0;
+    } else if (auto batch = std::find(args.begin(), args.end(), "--batch"); batch != args.end()) {
+        compile_batch(stamp, {args.begin(), batch}, expand_response_files({batch + 1, args.end()}));
     } else {
-        fmt::print("sub x0, x1, x0\n");
-    }
-}
-
-void emit_expr(const ExprVal& expr) {
-    if (auto e = expr.cast<IntegerConstantExpr>()) {
-        emit_loc(expr);
-        emit_constant("x0", e->value);
-        return;
-    }
-
-    if (auto e = expr.cast<VariableExpr>()) {
-        fmt::print("ldr x0, [fp, {}]\n", f.locals[e->ident]);
-        return;
-    }
-
-    if (auto e = expr.cast<UnOpExpr>()) {
-        if (e->op == UnOpKind::AddressOf) {
-            emit_addr(e->e);
-            return;
-        }
-
-        emit_expr(e->e);
-
-        emit_loc(expr);
-        switch (e->op) {
-        case UnOpKind::Dereference:
-            fmt::print("ldr x0, [x0]\n");
-            return;
-        case UnOpKind::Posate:
-            // do nothing
-            return;
-        case UnOpKind::Negate:
-            fmt::print("neg x0, x0\n");
-            return;
-        default:
-            ASSERT(!"Unknown unop kind");
-        }
-    }
-
-    if (auto e = expr.cast<BinOpExpr>()) {
-        emit_expr(e->lhs);
-        fmt::print("str x0, [sp, -16]!\n");
-        emit_expr(e->rhs);
-        fmt::print("ldr x1, [sp], 16\n");
-
-        emit_loc(expr);
-        switch (e->op) {
-        case BinOpKind::Add:
-        case BinOpKind::Subtract:
-            emit_addsub(e);
-            return;
-        case BinOpKind::Multiply:
-            fmt::print("mul x0, x1, x0\n");
-            return;
-        case BinOpKind::Divide:
-            fmt::print("udiv x0, x1, x0\n");  // unsigned divide for now
-            return;
-        case BinOpKind::Modulo:
-            fmt::print("udiv x2, x1, x0\n");  // unsigned for now
-            fmt::print("msub x0, x2, x0, x1\n");
-            return;
-        case BinOpKind::LessThan:
-            fmt::print("cmp x1, x0\n");
-            fmt::print("cset x0, lt\n");  // signed compare
-            return;
-        case BinOpKind::GreaterThan:
-            fmt::print("cmp x1, x0\n");
-            fmt::print("cset x0, gt\n");  // signed compare
-            return;
-        case BinOpKind::LessThanEqual:
-            fmt::print("cmp x1, x0\n");
-            fmt::print("cset x0, le\n");  // signed compare
-            return;
-        case BinOpKind::GreaterThanEqual:
-            fmt::print("cmp x1, x0\n");
-            fmt::print("cset x0, ge\n");  // signed compare
-            return;
-        case BinOpKind::Equal:
-            fmt::print("cmp x1, x0\n");
-            fmt::print("cset x0, eq\n");
-            return;
-        case BinOpKind::NotEqual:
-            fmt::print("cmp x1, x0\n");
-            fmt::print("cset x0, ne\n");
-            return;
-        case BinOpKind::BitAnd:
-            fmt::print("and x0, x1, x0\n");
-            return;
-        case BinOpKind::BitXor:
-            fmt::print("eor x0, x1, x0\n");
-            return;
-        case BinOpKind::BitOr:
-            fmt::print("orr x0, x1, x0\n");
-            return;
-        default:
-            ASSERT(!"Unknown binop kind");
-        }
+        const std::string output = compile(parse_invocation(stamp, args));
+        PhaseTimer timer{Phase::Output};
+        fmt::print("{}", output);
+        std::fflush(stdout);
     }
 
-    if (auto e = expr.cast<AssignExpr>()) {
-        emit_addr(e->lhs);
-        fmt::print("str x0, [sp, -16]!\n");
-        emit_expr(e->rhs);
-        fmt::print("ldr x1, [sp], 16\n");
-        fmt::print("str x0, [x1]\n");
-        return;
-    }
-
-    ASSERT(!"Unknown expr kind");
-}
-
-void emit_stmt(const StmtVal& stmt) {
-    if (auto s = stmt.cast<CompoundStmt>()) {
-        for (auto& i : s->items) {
-            emit_stmt(i);
-        }
-        return;
-    }
-
-    if (auto s = stmt.cast<ExprStmt>()) {
-        if (s->e)
-            emit_expr(s->e);
-        return;
-    }
-
-    if (auto s = stmt.cast<IfStmt>()) {
-        const int i = iota();
-        emit_expr(s->cond);
-        fmt::print("cmp x0, 0\n");
-        fmt::print("b.eq .if{}.else\n", i);
-        emit_stmt(s->then_);
-        fmt::print("b .if{}.end\n", i);
-        fmt::print(".if{}.else:\n", i);
-        if (s->else_)
-            emit_stmt(s->else_);
-        fmt::print(".if{}.end:\n", i);
-        return;
-    }
-
-    if (auto s = stmt.cast<LoopStmt>()) {
-        const int i = iota();
-        if (s->init) {
-            emit_expr(s->init);
-        }
-        fmt::print(".loop{}.cond:\n", i);
-        if (s->cond) {
-            emit_expr(s->cond);
-            fmt::print("cmp x0, 0\n");
-            fmt::print("b.eq .loop{}.end\n", i);
-        }
-        emit_stmt(s->then);
-        if (s->incr)
-            emit_expr(s->incr);
-        fmt::print("b .loop{}.cond\n", i);
-        fmt::print(".loop{}.end:\n", i);
-        return;
-    }
-
-    if (auto s = stmt.cast<ReturnStmt>()) {
-        if (s->e)
-            emit_expr(s->e);
-
-        emit_loc(stmt);
-        fmt::print("ret\n");
-        return;
-    }
-
-    if (auto s = stmt.cast<DeclStmt>()) {
-        // TODO: no duplicates
-        f.locals[s->ident] = f.stack_size;
-        f.stack_size += 8;
-        return;
-    }
-
-    ASSERT(!"Unknown stmt kind");
-}
-
-int main(int argc, char* argv[]) {
-    ASSERT(argc == 2);
-
-    Parser p{TokenStream{CharStream{1, argv[1]}}};
-
-    fmt::print(".file 1 \"stdin\"\n");
-    fmt::print(".text\n");
-    fmt::print(".globl _main\n");
-    fmt::print(".align 4\n");
-    fmt::print("_main:\n");
-
-    fmt::print("mov fp, sp\n");
-    fmt::print("sub sp, sp, 256\n");
-
-    StmtVal s = p.statement();
-    emit_stmt(s);
-
-    fmt::print("add sp, sp, 256\n");
-    fmt::print("ret\n");
-
-    return 0;
+    if (time_format)
+        fmt::print(stderr, "{}", time_report(*time_format));
+#ifdef SMOLCC_TRACE_ALLOCATIONS
+    fmt::print(stderr, "{}", allocation_report());
+#endif
+    return status;
 }
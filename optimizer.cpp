@@ -0,0 +1,903 @@
+// This file is part of the smolcc project
+// SPDX-License-Identifier: MIT
+
+#include "optimizer.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <set>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include <fmt/core.h>
+
+#include "assert.h"
+#include "poly_value.h"
+
+namespace {
+
+struct OptContext {
+    int next_temporary = 1;
+    // Frame slots left for temporaries
+    int free_slots = 0;
+
+    std::string make_temporary() {
+        ASSERT(free_slots > 0);
+        free_slots--;
+        // Not a valid C identifier, so it cannot collide with user locals
+        return fmt::format(".t{}", next_temporary++);
+    }
+};
+
+// Side effects of a loop relevant to deciding whether a value may change between iterations.
+// Tests rely on pointer arithmetic walking from one local into its neighbours, so any store
+// through a pointer is assumed to clobber every local.
+struct LoopEffects {
+    std::set<std::string> written;
+    bool stores_indirectly = false;
+};
+
+}  // namespace
+
+template<typename F>
+static void visit_subexprs(ExprVal& expr, F&& f) {
+    if (!expr)
+        return;
+
+    f(expr);
+
+    if (auto e = expr.cast<UnOpExpr>()) {
+        visit_subexprs(e->e, f);
+    } else if (auto e = expr.cast<BinOpExpr>()) {
+        visit_subexprs(e->lhs, f);
+        visit_subexprs(e->rhs, f);
+    } else if (auto e = expr.cast<AssignExpr>()) {
+        visit_subexprs(e->lhs, f);
+        visit_subexprs(e->rhs, f);
+    }
+}
+
+// Calls f on every root expression within stmt, including those of nested statements
+template<typename F>
+static void visit_exprs(StmtVal& stmt, F&& f) {
+    if (!stmt)
+        return;
+
+    if (auto s = stmt.cast<CompoundStmt>()) {
+        for (auto& i : s->items) {
+            visit_exprs(i, f);
+        }
+    } else if (auto s = stmt.cast<ExprStmt>()) {
+        f(s->e);
+    } else if (auto s = stmt.cast<IfStmt>()) {
+        f(s->cond);
+        visit_exprs(s->then_, f);
+        visit_exprs(s->else_, f);
+    } else if (auto s = stmt.cast<LoopStmt>()) {
+        f(s->init);
+        f(s->cond);
+        f(s->incr);
+        visit_exprs(s->then, f);
+    } else if (auto s = stmt.cast<ReturnStmt>()) {
+        f(s->e);
+    }
+}
+
+static void collect_effects(ExprVal& root, LoopEffects& fx) {
+    visit_subexprs(root, [&](ExprVal& expr) {
+        if (auto e = expr.cast<AssignExpr>()) {
+            if (auto v = e->lhs.cast<VariableExpr>()) {
+                fx.written.insert(v->ident);
+            } else {
+                fx.stores_indirectly = true;
+            }
+        }
+    });
+}
+
+static LoopEffects loop_effects(LoopStmt* loop) {
+    LoopEffects fx;
+    collect_effects(loop->cond, fx);
+    collect_effects(loop->incr, fx);
+    visit_exprs(loop->then, [&](ExprVal& e) { collect_effects(e, fx); });
+    return fx;
+}
+
+// An expression is loop invariant if it has no side effects, cannot trap when evaluated
+// speculatively, and reads nothing the loop may write.
+static bool is_loop_invariant(const ExprVal& expr, const LoopEffects& fx) {
+    if (expr.cast<IntegerConstantExpr>()) {
+        return true;
+    }
+
+    if (auto e = expr.cast<VariableExpr>()) {
+        return !fx.stores_indirectly && !fx.written.contains(e->ident);
+    }
+
+    if (auto e = expr.cast<UnOpExpr>()) {
+        switch (e->op) {
+        case UnOpKind::AddressOf:
+            return e->e.cast<VariableExpr>() != nullptr;
+        case UnOpKind::Dereference:
+            // Loads are not hoisted: the loop may not execute and the address may be invalid
+            return false;
+        case UnOpKind::Posate:
+        case UnOpKind::Negate:
+            return is_loop_invariant(e->e, fx);
+        }
+    }
+
+    if (auto e = expr.cast<BinOpExpr>()) {
+        // sdiv does not trap on division by zero, so every binop is safe to speculate
+        return is_loop_invariant(e->lhs, fx) && is_loop_invariant(e->rhs, fx);
+    }
+
+    return false;
+}
+
+// Quotient as computed by sdiv, which yields zero on division by zero and wraps on overflow
+static uintmax_t signed_divide(uintmax_t lhs, uintmax_t rhs) {
+    const auto l = static_cast<intmax_t>(lhs);
+    const auto r = static_cast<intmax_t>(rhs);
+    if (r == 0)
+        return 0;
+    if (r == -1)
+        return -lhs;
+    return static_cast<uintmax_t>(l / r);
+}
+
+// Value of expr if it is a compile-time constant, computed as codegen would at runtime
+static std::optional<uintmax_t> constant_value(const ExprVal& expr) {
+    if (auto e = expr.cast<IntegerConstantExpr>()) {
+        return e->value;
+    }
+
+    if (auto e = expr.cast<UnOpExpr>()) {
+        const auto v = constant_value(e->e);
+        if (!v)
+            return std::nullopt;
+        switch (e->op) {
+        case UnOpKind::Posate:
+            return *v;
+        case UnOpKind::Negate:
+            return -*v;
+        default:
+            return std::nullopt;
+        }
+    }
+
+    if (auto e = expr.cast<BinOpExpr>()) {
+        const auto l = constant_value(e->lhs);
+        // The rhs is never evaluated once a constant lhs decides && or ||
+        if (l && e->op == BinOpKind::LogicalAnd && *l == 0)
+            return 0;
+        if (l && e->op == BinOpKind::LogicalOr && *l != 0)
+            return 1;
+        const auto r = constant_value(e->rhs);
+        if (!l || !r)
+            return std::nullopt;
+        const auto sl = static_cast<intmax_t>(*l);
+        const auto sr = static_cast<intmax_t>(*r);
+        switch (e->op) {
+        case BinOpKind::Add:
+            return *l + *r;
+        case BinOpKind::Subtract:
+            return *l - *r;
+        case BinOpKind::Multiply:
+            return *l * *r;
+        case BinOpKind::Divide:
+            return signed_divide(*l, *r);
+        case BinOpKind::Modulo:
+            return *l - signed_divide(*l, *r) * *r;
+        case BinOpKind::LessThan:
+            return sl < sr;
+        case BinOpKind::GreaterThan:
+            return sl > sr;
+        case BinOpKind::LessThanEqual:
+            return sl <= sr;
+        case BinOpKind::GreaterThanEqual:
+            return sl >= sr;
+        case BinOpKind::Equal:
+            return *l == *r;
+        case BinOpKind::NotEqual:
+            return *l != *r;
+        case BinOpKind::BitAnd:
+            return *l & *r;
+        case BinOpKind::BitXor:
+            return *l ^ *r;
+        case BinOpKind::BitOr:
+            return *l | *r;
+        case BinOpKind::LogicalAnd:
+            return *l && *r;
+        case BinOpKind::LogicalOr:
+            return *l || *r;
+        default:
+            return std::nullopt;
+        }
+    }
+
+    return std::nullopt;
+}
+
+// Replaces constant subexpressions with their values
+static void fold_constants(ExprVal& expr) {
+    if (!expr || expr.cast<IntegerConstantExpr>())
+        return;
+
+    if (auto e = expr.cast<UnOpExpr>()) {
+        fold_constants(e->e);
+    } else if (auto e = expr.cast<BinOpExpr>()) {
+        fold_constants(e->lhs);
+        fold_constants(e->rhs);
+    } else if (auto e = expr.cast<AssignExpr>()) {
+        fold_constants(e->lhs);
+        fold_constants(e->rhs);
+    }
+
+    if (const auto value = constant_value(expr))
+        expr = make_expr<IntegerConstantExpr>(expr->loc, *value);
+}
+
+bool falls_through(const StmtVal& stmt) {
+    if (auto s = stmt.cast<CompoundStmt>()) {
+        for (auto& i : s->items) {
+            if (!falls_through(i))
+                return false;
+        }
+        return true;
+    }
+
+    if (auto s = stmt.cast<IfStmt>()) {
+        return !s->else_ || falls_through(s->then_) || falls_through(s->else_);
+    }
+
+    if (auto s = stmt.cast<LoopStmt>()) {
+        // Without break, a loop with no condition can only be left by returning
+        return static_cast<bool>(s->cond);
+    }
+
+    return !stmt.cast<ReturnStmt>();
+}
+
+// Folds branches on constant conditions and removes statements that cannot be reached. There is no
+// goto, break or continue, so reachability follows directly from the structure of the AST.
+static void simplify_control_flow(StmtVal& stmt) {
+    if (auto s = stmt.cast<CompoundStmt>()) {
+        for (auto& i : s->items) {
+            simplify_control_flow(i);
+        }
+        for (auto it = s->items.begin(); it != s->items.end(); ++it) {
+            if (!falls_through(*it)) {
+                s->items.erase(it + 1, s->items.end());
+                break;
+            }
+        }
+        return;
+    }
+
+    if (auto s = stmt.cast<IfStmt>()) {
+        if (const auto cond = constant_value(s->cond)) {
+            StmtVal taken = *cond ? std::move(s->then_) : std::move(s->else_);
+            stmt = taken ? std::move(taken) : make_stmt<ExprStmt>(stmt->loc, nullptr);
+            simplify_control_flow(stmt);
+            return;
+        }
+        simplify_control_flow(s->then_);
+        if (s->else_)
+            simplify_control_flow(s->else_);
+        return;
+    }
+
+    if (auto s = stmt.cast<LoopStmt>()) {
+        const Location loc = stmt->loc;
+
+        if (const auto cond = constant_value(s->cond)) {
+            if (!*cond) {
+                stmt = make_stmt<ExprStmt>(loc, std::move(s->init));
+                return;
+            }
+            s->cond = nullptr;
+        }
+
+        simplify_control_flow(s->then);
+        if (falls_through(s->then))
+            return;
+
+        // The body always returns, so the loop runs at most once: `{ init; if (cond) body }`
+        std::vector<StmtVal> items;
+        if (s->init)
+            items.emplace_back(make_stmt<ExprStmt>(loc, std::move(s->init)));
+        if (s->cond) {
+            items.emplace_back(make_stmt<IfStmt>(loc, std::move(s->cond), std::move(s->then), nullptr));
+        } else {
+            items.emplace_back(std::move(s->then));
+        }
+        stmt = make_stmt<CompoundStmt>(loc, std::move(items));
+        return;
+    }
+}
+
+// Locals that may be read before they are next written
+struct Liveness {
+    std::set<std::string> vars;
+    // A load through a pointer may read any local
+    bool all = false;
+
+    bool contains(const std::string& ident) const { return all || vars.contains(ident); }
+
+    void merge(const Liveness& other) {
+        vars.insert(other.vars.begin(), other.vars.end());
+        all |= other.all;
+    }
+
+    bool operator==(const Liveness&) const = default;
+};
+
+static void add_uses(const ExprVal& expr, Liveness& live) {
+    if (!expr)
+        return;
+
+    if (auto e = expr.cast<VariableExpr>()) {
+        live.vars.insert(e->ident);
+    } else if (auto e = expr.cast<UnOpExpr>()) {
+        if (e->op == UnOpKind::AddressOf && e->e.cast<VariableExpr>())
+            return;
+        if (e->op == UnOpKind::Dereference)
+            live.all = true;
+        add_uses(e->e, live);
+    } else if (auto e = expr.cast<BinOpExpr>()) {
+        add_uses(e->lhs, live);
+        add_uses(e->rhs, live);
+    } else if (auto e = expr.cast<AssignExpr>()) {
+        // Storing to a local or through a pointer reads neither, only the address computation
+        if (auto lhs = e->lhs.cast<UnOpExpr>())
+            add_uses(lhs->e, live);
+        add_uses(e->rhs, live);
+    }
+}
+
+static bool has_side_effects(ExprVal& expr) {
+    bool result = false;
+    visit_subexprs(expr, [&](ExprVal& e) { result |= e.cast<AssignExpr>() != nullptr; });
+    return result;
+}
+
+// Liveness before expr given the liveness after it
+static Liveness live_before(const ExprVal& expr, Liveness live) {
+    if (auto e = expr.cast<AssignExpr>()) {
+        if (auto v = e->lhs.cast<VariableExpr>())
+            live.vars.erase(v->ident);
+    }
+    add_uses(expr, live);
+    return live;
+}
+
+// Declarations, empty statements and blocks of them leave x0 alone
+static bool emits_code(const StmtVal& stmt) {
+    if (stmt.cast<DeclStmt>())
+        return false;
+    if (auto s = stmt.cast<ExprStmt>())
+        return static_cast<bool>(s->e);
+    if (auto s = stmt.cast<CompoundStmt>())
+        return std::any_of(s->items.begin(), s->items.end(), [](const StmtVal& item) { return emits_code(item); });
+    return true;
+}
+
+// Computes liveness backwards through stmt, returning the liveness on entry. When rewrite is set,
+// stores to locals that are dead afterwards are removed, keeping the stored expression for its
+// side effects, and side-effect-free expression statements are dropped. An expression statement
+// in tail position is kept, as its value falls through to the function's return value.
+static Liveness eliminate_dead_stores(StmtVal& stmt, Liveness live, bool rewrite, bool tail) {
+    if (auto s = stmt.cast<CompoundStmt>()) {
+        // The tail is the last item that emits code, not a trailing declaration
+        bool in_tail = tail;
+        for (auto it = s->items.rbegin(); it != s->items.rend(); ++it) {
+            live = eliminate_dead_stores(*it, std::move(live), rewrite, in_tail);
+            in_tail = in_tail && !emits_code(*it);
+        }
+        return live;
+    }
+
+    if (auto s = stmt.cast<ExprStmt>()) {
+        if (!s->e)
+            return live;
+        if (rewrite) {
+            if (auto e = s->e.cast<AssignExpr>()) {
+                auto v = e->lhs.cast<VariableExpr>();
+                if (v && !live.contains(v->ident))
+                    s->e = std::move(e->rhs);
+            }
+            if (!tail && !has_side_effects(s->e)) {
+                s->e = nullptr;
+                return live;
+            }
+        }
+        return live_before(s->e, std::move(live));
+    }
+
+    if (auto s = stmt.cast<IfStmt>()) {
+        Liveness result = eliminate_dead_stores(s->then_, live, rewrite, tail);
+        if (s->else_) {
+            result.merge(eliminate_dead_stores(s->else_, std::move(live), rewrite, tail));
+        } else {
+            result.merge(live);
+        }
+        return live_before(s->cond, std::move(result));
+    }
+
+    if (auto s = stmt.cast<LoopStmt>()) {
+        // Iterate to a fixed point on the liveness at the top of the loop, where the condition is tested
+        Liveness head = live_before(s->cond, live);
+        while (true) {
+            Liveness next = live;
+            next.merge(eliminate_dead_stores(s->then, live_before(s->incr, head), false, false));
+            next = live_before(s->cond, std::move(next));
+            if (next == head)
+                break;
+            head = std::move(next);
+        }
+        if (rewrite)
+            eliminate_dead_stores(s->then, live_before(s->incr, head), true, false);
+        return live_before(s->init, std::move(head));
+    }
+
+    if (auto s = stmt.cast<ReturnStmt>()) {
+        Liveness result;
+        add_uses(s->e, result);
+        return result;
+    }
+
+    if (stmt.cast<DeclStmt>()) {
+        return live;
+    }
+
+    // Unknown statements are assumed to read every local
+    Liveness result;
+    result.all = true;
+    return result;
+}
+
+// Calls f on every loop within stmt, innermost first. f may replace the loop statement.
+template<typename F>
+static void for_each_loop(StmtVal& stmt, F&& f) {
+    if (auto s = stmt.cast<CompoundStmt>()) {
+        for (auto& i : s->items) {
+            for_each_loop(i, f);
+        }
+    } else if (auto s = stmt.cast<IfStmt>()) {
+        for_each_loop(s->then_, f);
+        if (s->else_)
+            for_each_loop(s->else_, f);
+    } else if (auto s = stmt.cast<LoopStmt>()) {
+        for_each_loop(s->then, f);
+        f(stmt, s);
+    }
+}
+
+// Declares a new temporary initialised to value in preheader, and returns a reference to it
+static ExprVal make_temporary(ExprVal value, OptContext& ctx, std::vector<StmtVal>& preheader) {
+    const Location loc = value->loc;
+    const std::string temp = ctx.make_temporary();
+    const TypeVal type = value->type();
+
+    preheader.emplace_back(make_stmt<DeclStmt>(loc, temp));
+    preheader.emplace_back(make_stmt<ExprStmt>(loc, make_expr<AssignExpr>(loc, make_expr<VariableExpr>(loc, temp, type), std::move(value))));
+    return make_expr<VariableExpr>(loc, temp, type);
+}
+
+// Rewrites `for (init; cond; incr) body` into `{ init; preheader...; for (; cond; incr) body }`
+static void insert_preheader(StmtVal& stmt, LoopStmt* loop, std::vector<StmtVal> preheader) {
+    if (preheader.empty())
+        return;
+
+    const Location loc = stmt->loc;
+    std::vector<StmtVal> items;
+    if (loop->init)
+        items.emplace_back(make_stmt<ExprStmt>(loc, std::move(loop->init)));
+    for (auto& i : preheader) {
+        items.emplace_back(std::move(i));
+    }
+    items.emplace_back(std::move(stmt));
+    stmt = make_stmt<CompoundStmt>(loc, std::move(items));
+}
+
+// Replaces maximal invariant subexpressions of expr worth more than a stack reload with temporaries
+// computed in the preheader.
+static void hoist_invariants(ExprVal& expr, const LoopEffects& fx, OptContext& ctx, std::vector<StmtVal>& preheader) {
+    if (!expr)
+        return;
+
+    if (expr.cast<BinOpExpr>() && is_loop_invariant(expr, fx) && ctx.free_slots > 0) {
+        expr = make_temporary(std::move(expr), ctx, preheader);
+        return;
+    }
+
+    if (auto e = expr.cast<UnOpExpr>()) {
+        hoist_invariants(e->e, fx, ctx, preheader);
+    } else if (auto e = expr.cast<BinOpExpr>()) {
+        hoist_invariants(e->lhs, fx, ctx, preheader);
+        hoist_invariants(e->rhs, fx, ctx, preheader);
+    } else if (auto e = expr.cast<AssignExpr>()) {
+        hoist_invariants(e->lhs, fx, ctx, preheader);
+        hoist_invariants(e->rhs, fx, ctx, preheader);
+    }
+}
+
+// Hoists loop-invariant computations out of loops into a preheader
+static void licm(StmtVal& stmt, OptContext& ctx) {
+    for_each_loop(stmt, [&](StmtVal& loop_stmt, LoopStmt* loop) {
+        const LoopEffects fx = loop_effects(loop);
+        std::vector<StmtVal> preheader;
+        hoist_invariants(loop->cond, fx, ctx, preheader);
+        hoist_invariants(loop->incr, fx, ctx, preheader);
+        visit_exprs(loop->then, [&](ExprVal& e) { hoist_invariants(e, fx, ctx, preheader); });
+        insert_preheader(loop_stmt, loop, std::move(preheader));
+    });
+}
+
+// A basic induction variable `i` stepped once per iteration by `i = i + c` or `i = i - c`. step
+// is the signed change per iteration, so `i = i + -1` and `i = i - 1` both have a step of -1.
+struct InductionVariable {
+    std::string ident;
+    std::intmax_t step;
+};
+
+static std::optional<InductionVariable> find_induction_variable(LoopStmt* loop) {
+    auto assign = loop->incr.cast<AssignExpr>();
+    if (!assign)
+        return std::nullopt;
+    auto var = assign->lhs.cast<VariableExpr>();
+    auto update = assign->rhs.cast<BinOpExpr>();
+    if (!var || var->type()->is_pointer() || !update || (update->op != BinOpKind::Add && update->op != BinOpKind::Subtract))
+        return std::nullopt;
+    auto lhs = update->lhs.cast<VariableExpr>();
+    auto step = update->rhs.cast<IntegerConstantExpr>();
+    if (!lhs || lhs->ident != var->ident || !step)
+        return std::nullopt;
+
+    // The increment must be the only thing that can change the counter
+    LoopEffects fx;
+    collect_effects(loop->cond, fx);
+    visit_exprs(loop->then, [&](ExprVal& e) { collect_effects(e, fx); });
+    if (fx.stores_indirectly || fx.written.contains(var->ident))
+        return std::nullopt;
+
+    // Constants are 64-bit patterns that folding may have made negative. The most negative one
+    // has no negation, so its step could not be reversed.
+    const auto value = static_cast<std::intmax_t>(step->value);
+    if (value == std::numeric_limits<std::intmax_t>::min())
+        return std::nullopt;
+    return InductionVariable{var->ident, update->op == BinOpKind::Add ? value : -value};
+}
+
+// `e + delta`, written as a subtraction when delta is negative
+static ExprVal make_offset(Location loc, ExprVal e, std::intmax_t delta) {
+    const BinOpKind op = delta < 0 ? BinOpKind::Subtract : BinOpKind::Add;
+    const std::uintmax_t magnitude = delta < 0 ? 0 - static_cast<std::uintmax_t>(delta) : static_cast<std::uintmax_t>(delta);
+    return make_expr<BinOpExpr>(loc, op, std::move(e), make_expr<IntegerConstantExpr>(loc, magnitude));
+}
+
+static bool is_variable(const ExprVal& expr, std::string_view ident) {
+    auto e = expr.cast<VariableExpr>();
+    return e && e->ident == ident;
+}
+
+// Replaces `p + i`, `i + p` and `p - i` for invariant pointers p with a pointer that is stepped
+// alongside i, appending the statements that step each such pointer to steps.
+static void reduce_pointer_offsets(ExprVal& expr, const InductionVariable& iv, const LoopEffects& fx, OptContext& ctx, std::vector<StmtVal>& preheader, std::vector<StmtVal>& steps) {
+    if (!expr)
+        return;
+
+    if (auto e = expr.cast<BinOpExpr>(); e && (e->op == BinOpKind::Add || e->op == BinOpKind::Subtract)) {
+        const bool lhs_is_base = is_variable(e->rhs, iv.ident) && e->lhs->type()->is_pointer() && is_loop_invariant(e->lhs, fx);
+        const bool rhs_is_base = e->op == BinOpKind::Add && is_variable(e->lhs, iv.ident) && e->rhs->type()->is_pointer() && is_loop_invariant(e->rhs, fx);
+        if ((lhs_is_base || rhs_is_base) && ctx.free_slots > 0) {
+            const Location loc = expr->loc;
+            // p - i moves the pointer against the counter
+            const std::intmax_t delta = e->op == BinOpKind::Add ? iv.step : -iv.step;
+
+            ExprVal ptr = make_temporary(std::move(expr), ctx, preheader);
+            steps.emplace_back(make_stmt<ExprStmt>(loc, make_expr<AssignExpr>(loc, ptr, make_offset(loc, ptr, delta))));
+            expr = std::move(ptr);
+            return;
+        }
+    }
+
+    if (auto e = expr.cast<UnOpExpr>()) {
+        reduce_pointer_offsets(e->e, iv, fx, ctx, preheader, steps);
+    } else if (auto e = expr.cast<BinOpExpr>()) {
+        reduce_pointer_offsets(e->lhs, iv, fx, ctx, preheader, steps);
+        reduce_pointer_offsets(e->rhs, iv, fx, ctx, preheader, steps);
+    } else if (auto e = expr.cast<AssignExpr>()) {
+        reduce_pointer_offsets(e->lhs, iv, fx, ctx, preheader, steps);
+        reduce_pointer_offsets(e->rhs, iv, fx, ctx, preheader, steps);
+    }
+}
+
+// Strength-reduces pointer offsets by a basic induction variable, so that each iteration steps
+// a pointer by a constant instead of rescaling the counter. The steps are appended to the body,
+// which is equivalent to running them with the increment as there is no break or continue.
+static void strength_reduce(StmtVal& stmt, OptContext& ctx) {
+    for_each_loop(stmt, [&](StmtVal& loop_stmt, LoopStmt* loop) {
+        const auto iv = find_induction_variable(loop);
+        if (!iv)
+            return;
+
+        const LoopEffects fx = loop_effects(loop);
+        std::vector<StmtVal> preheader;
+        std::vector<StmtVal> steps;
+        reduce_pointer_offsets(loop->cond, *iv, fx, ctx, preheader, steps);
+        visit_exprs(loop->then, [&](ExprVal& e) { reduce_pointer_offsets(e, *iv, fx, ctx, preheader, steps); });
+        if (steps.empty())
+            return;
+
+        const Location loc = loop->then->loc;
+        steps.insert(steps.begin(), std::move(loop->then));
+        loop->then = make_stmt<CompoundStmt>(loc, std::move(steps));
+        insert_preheader(loop_stmt, loop, std::move(preheader));
+    });
+}
+
+// Rough proxy for the amount of code an expression or statement generates
+static std::size_t code_size(ExprVal& expr) {
+    std::size_t size = 0;
+    visit_subexprs(expr, [&](ExprVal&) { size++; });
+    return size;
+}
+
+static std::size_t code_size(StmtVal& stmt) {
+    std::size_t size = 0;
+    visit_exprs(stmt, [&](ExprVal& e) { size += code_size(e); });
+    return size;
+}
+
+// Largest code size an unrolled loop body may grow to
+static constexpr std::size_t unroll_budget = 64;
+static constexpr std::uintmax_t max_full_unroll_count = 16;
+
+// A loop `for (init; i op bound; i = i +/- step)` with an invariant bound, counting towards it
+struct CountedLoop {
+    InductionVariable iv;
+    BinOpKind cmp;
+    std::optional<std::uintmax_t> trip_count;
+};
+
+static std::optional<CountedLoop> find_counted_loop(LoopStmt* loop) {
+    const auto iv = find_induction_variable(loop);
+    if (!iv || iv->step == 0)
+        return std::nullopt;
+
+    auto cond = loop->cond.cast<BinOpExpr>();
+    if (!cond || !is_variable(cond->lhs, iv->ident) || !is_loop_invariant(cond->rhs, loop_effects(loop)))
+        return std::nullopt;
+
+    // A step away from the bound never reaches it, so the loop is not counted
+    const bool counts_up = iv->step > 0;
+    if (counts_up ? (cond->op != BinOpKind::LessThan && cond->op != BinOpKind::LessThanEqual)
+                  : (cond->op != BinOpKind::GreaterThan && cond->op != BinOpKind::GreaterThanEqual))
+        return std::nullopt;
+
+    CountedLoop result{*iv, cond->op, std::nullopt};
+
+    auto init = loop->init.cast<AssignExpr>();
+    auto start = init && is_variable(init->lhs, iv->ident) ? init->rhs.cast<IntegerConstantExpr>() : nullptr;
+    auto end = cond->rhs.cast<IntegerConstantExpr>();
+    if (start && end) {
+        // Comparisons are signed
+        const auto from = static_cast<intmax_t>(counts_up ? start->value : end->value);
+        const auto to = static_cast<intmax_t>(counts_up ? end->value : start->value);
+        const bool inclusive = cond->op == BinOpKind::LessThanEqual || cond->op == BinOpKind::GreaterThanEqual;
+        if (to < from || (to == from && !inclusive)) {
+            result.trip_count = 0;
+        } else {
+            const auto distance = static_cast<uintmax_t>(to) - static_cast<uintmax_t>(from);
+            const std::uintmax_t magnitude = counts_up ? iv->step : 0 - static_cast<std::uintmax_t>(iv->step);
+            // A count that does not fit would wrap to a small one, and the loop would be cut short
+            const std::uintmax_t max = std::numeric_limits<std::uintmax_t>::max();
+            if (inclusive ? distance / magnitude == max : distance > max - (magnitude - 1))
+                return std::nullopt;
+            result.trip_count = inclusive ? distance / magnitude + 1 : (distance + magnitude - 1) / magnitude;
+
+            // Nor may the counter wrap on its way out, which would send it back into range
+            const auto first = static_cast<std::uintmax_t>(counts_up ? from : to);
+            const std::uintmax_t headroom = counts_up ? static_cast<std::uintmax_t>(std::numeric_limits<std::intmax_t>::max()) - first
+                                                      : first - static_cast<std::uintmax_t>(std::numeric_limits<std::intmax_t>::min());
+            if (*result.trip_count > headroom / magnitude)
+                return std::nullopt;
+        }
+    }
+
+    return result;
+}
+
+// Fully unrolls counted loops with a small known trip count. Otherwise unrolls by the largest
+// factor of 8, 4 or 2 that fits the budget, followed by a remainder loop:
+// `{ init; for (; i + (n-1)*step < bound; incr) { body; incr; ...; body } for (; cond; incr) body }`
+static void unroll(StmtVal& stmt) {
+    for_each_loop(stmt, [&](StmtVal& loop_stmt, LoopStmt* loop) {
+        const auto counted = find_counted_loop(loop);
+        if (!counted)
+            return;
+
+        const Location loc = loop_stmt->loc;
+        const std::size_t size = code_size(loop->then) + code_size(loop->incr);
+        std::vector<StmtVal> items;
+
+        if (counted->trip_count && *counted->trip_count <= max_full_unroll_count && *counted->trip_count * size <= unroll_budget) {
+            if (loop->init)
+                items.emplace_back(make_stmt<ExprStmt>(loc, std::move(loop->init)));
+            for (std::uintmax_t i = 0; i < *counted->trip_count; i++) {
+                items.emplace_back(loop->then);
+                items.emplace_back(make_stmt<ExprStmt>(loc, loop->incr));
+            }
+            loop_stmt = make_stmt<CompoundStmt>(loc, std::move(items));
+            return;
+        }
+
+        // The lookahead of (factor - 1) steps must not overflow
+        auto lookahead_fits = [&](std::uintmax_t factor) {
+            const std::intmax_t step = counted->iv.step;
+            const std::intmax_t limit = std::numeric_limits<std::intmax_t>::max() / static_cast<std::intmax_t>(factor - 1);
+            return step <= limit && step >= -limit;
+        };
+        std::uintmax_t factor = 8;
+        while (factor > 1 && (factor * size > unroll_budget || (counted->trip_count && *counted->trip_count < factor) || !lookahead_fits(factor))) {
+            factor /= 2;
+        }
+        if (factor == 1)
+            return;
+        if (loop->init)
+            items.emplace_back(make_stmt<ExprStmt>(loc, std::move(loop->init)));
+
+        std::vector<StmtVal> unrolled_body;
+        for (std::uintmax_t i = 0; i < factor; i++) {
+            if (i != 0)
+                unrolled_body.emplace_back(make_stmt<ExprStmt>(loc, loop->incr));
+            unrolled_body.emplace_back(loop->then);
+        }
+
+        // The last copy of the body runs with i advanced by (factor - 1) steps
+        auto cond = loop->cond.cast<BinOpExpr>();
+        const Location cond_loc = cond->loc;
+        ExprVal lookahead = make_offset(cond_loc, cond->lhs, static_cast<std::intmax_t>(factor - 1) * counted->iv.step);
+        ExprVal unrolled_cond = make_expr<BinOpExpr>(cond_loc, counted->cmp, std::move(lookahead), cond->rhs);
+
+        items.emplace_back(make_stmt<LoopStmt>(loc, nullptr, std::move(unrolled_cond), loop->incr, make_stmt<CompoundStmt>(loc, std::move(unrolled_body))));
+        items.emplace_back(std::move(loop_stmt));
+        loop_stmt = make_stmt<CompoundStmt>(loc, std::move(items));
+    });
+}
+
+// Base pointer p of `p + i` or `i + p`, where p points to 8-byte elements and is invariant under fx
+static ExprVal* lane_base(const ExprVal& expr, std::string_view i, const LoopEffects& fx) {
+    auto e = expr.cast<BinOpExpr>();
+    if (!e || e->op != BinOpKind::Add)
+        return nullptr;
+
+    ExprVal* base = is_variable(e->rhs, i) ? &e->lhs : is_variable(e->lhs, i) ? &e->rhs : nullptr;
+    if (!base)
+        return nullptr;
+    const TypeVal type = (*base)->type();
+    if (!type->is_pointer() || type.cast<PointerType>()->base->size() != 8 || !is_loop_invariant(*base, fx))
+        return nullptr;
+    return base;
+}
+
+static bool is_vectorizable(ExprVal& expr, std::string_view i, const LoopEffects& fx) {
+    if (auto e = expr.cast<UnOpExpr>()) {
+        switch (e->op) {
+        case UnOpKind::Dereference:
+            return lane_base(e->e, i, fx) != nullptr;
+        case UnOpKind::Posate:
+        case UnOpKind::Negate:
+            return is_vectorizable(e->e, i, fx);
+        default:
+            return false;
+        }
+    }
+
+    if (auto e = expr.cast<BinOpExpr>()) {
+        switch (e->op) {
+        case BinOpKind::Add:
+        case BinOpKind::Subtract:
+        case BinOpKind::BitAnd:
+        case BinOpKind::BitXor:
+        case BinOpKind::BitOr:
+            if (e->type()->is_pointer())
+                return false;
+            if (is_loop_invariant(expr, fx))
+                return true;
+            return is_vectorizable(e->lhs, i, fx) && is_vectorizable(e->rhs, i, fx);
+        default:
+            break;
+        }
+    }
+
+    return !expr->type()->is_pointer() && is_loop_invariant(expr, fx);
+}
+
+// Vectorizes element-wise loops `for (init; i < n; i = i + 1) *(p + i) = value;`. Only the shape is
+// checked here; whether the store can overlap the loads or the locals the loop reads depends on
+// runtime pointer values, so codegen checks that before entering the vector loop.
+static void vectorize(StmtVal& stmt) {
+    for_each_loop(stmt, [&](StmtVal& loop_stmt, LoopStmt* loop) {
+        auto cond = loop->cond.cast<BinOpExpr>();
+        auto incr = loop->incr.cast<AssignExpr>();
+        if (!cond || cond->op != BinOpKind::LessThan || !incr)
+            return;
+        auto counter = cond->lhs.cast<VariableExpr>();
+        if (!counter || counter->type()->is_pointer() || !is_variable(incr->lhs, counter->ident))
+            return;
+        auto update = incr->rhs.cast<BinOpExpr>();
+        auto step = update ? update->rhs.cast<IntegerConstantExpr>() : nullptr;
+        if (!update || update->op != BinOpKind::Add || !is_variable(update->lhs, counter->ident) || !step || step->value != 1)
+            return;
+
+        StmtVal* body = &loop->then;
+        if (auto s = body->cast<CompoundStmt>(); s && s->items.size() == 1)
+            body = &s->items[0];
+        auto expr_stmt = body->cast<ExprStmt>();
+        auto assign = expr_stmt ? expr_stmt->e.cast<AssignExpr>() : nullptr;
+        auto store = assign ? assign->lhs.cast<UnOpExpr>() : nullptr;
+        if (!store || store->op != UnOpKind::Dereference)
+            return;
+
+        // The only scalar the loop writes is the counter
+        LoopEffects fx;
+        fx.written.insert(counter->ident);
+
+        ExprVal* dst = lane_base(store->e, counter->ident, fx);
+        if (!dst || !is_loop_invariant(cond->rhs, fx) || cond->rhs->type()->is_pointer() || !is_vectorizable(assign->rhs, counter->ident, fx))
+            return;
+
+        const Location loc = loop_stmt->loc;
+        std::vector<StmtVal> items;
+        if (loop->init)
+            items.emplace_back(make_stmt<ExprStmt>(loc, std::move(loop->init)));
+        items.emplace_back(make_stmt<VectorLoopStmt>(loc, counter->ident, cond->rhs, *dst, assign->rhs));
+        items.emplace_back(std::move(loop_stmt));
+        loop_stmt = make_stmt<CompoundStmt>(loc, std::move(items));
+    });
+}
+
+// Constant folding and unreachable code removal, to be rerun after any pass that exposes new
+// constants, such as inlining once there are calls
+static void cleanup(StmtVal& body) {
+    visit_exprs(body, [](ExprVal& e) { fold_constants(e); });
+    simplify_control_flow(body);
+}
+
+// Collects the names body declares
+static void declared_locals(const StmtVal& stmt, std::set<std::string>& locals) {
+    if (auto s = stmt.cast<CompoundStmt>()) {
+        for (const auto& i : s->items)
+            declared_locals(i, locals);
+    } else if (auto s = stmt.cast<IfStmt>()) {
+        declared_locals(s->then_, locals);
+        if (s->else_)
+            declared_locals(s->else_, locals);
+    } else if (auto s = stmt.cast<LoopStmt>()) {
+        declared_locals(s->then, locals);
+    } else if (auto s = stmt.cast<DeclStmt>()) {
+        locals.insert(s->ident);
+    }
+}
+
+void optimize(StmtVal& body) {
+    std::set<std::string> locals;
+    declared_locals(body, locals);
+
+    OptContext ctx;
+    ctx.free_slots = max_locals - static_cast<int>(locals.size());
+    cleanup(body);
+    eliminate_dead_stores(body, Liveness{}, true, true);
+    licm(body, ctx);
+    vectorize(body);
+    strength_reduce(body, ctx);
+    unroll(body);
+}
@@ -0,0 +1,31 @@
+// This file is part of the smolcc project
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <string>
+
+#include "parser.h"
+
+// Runs `for (; counter < bound; counter = counter + 1) *(dst + counter) = value;` two lanes at a
+// time for as long as that is safe, leaving the remaining iterations to the scalar loop that
+// follows. Within value, each dereference loads one lane per iteration from `p + counter`, and
+// every other leaf is loop invariant and broadcast to all lanes.
+struct VectorLoopStmt : public Stmt {
+    VectorLoopStmt(Location loc, std::string counter, ExprVal bound, ExprVal dst, ExprVal value)
+            : counter(counter), bound(std::move(bound)), dst(std::move(dst)), value(std::move(value)), Stmt(loc) {}
+
+    std::string counter;
+    ExprVal bound;
+    ExprVal dst;
+    ExprVal value;
+};
+
+// Locals a function's fixed-size frame holds; passes that add temporaries stay within it
+inline constexpr int max_locals = 32;
+
+// Whether control can reach the end of stmt
+bool falls_through(const StmtVal& stmt);
+
+// Rewrites a function body in place with the AST-level optimization passes
+void optimize(StmtVal& body);
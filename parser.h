@@ -9,6 +9,7 @@
 
 #include "lexer.h"
 #include "poly_value.h"
+#include "timing.h"
 #include "types.h"
 
 struct Expr {
@@ -36,11 +37,12 @@ struct IntegerConstantExpr : public Expr {
 };
 
 struct VariableExpr : public Expr {
-    VariableExpr(Location loc, std::string ident)
-            : ident(ident), Expr(loc) {}
+    VariableExpr(Location loc, std::string ident, TypeVal var_type = make_int_type())
+            : ident(ident), var_type(std::move(var_type)), Expr(loc) {}
     std::string ident;
+    TypeVal var_type;
 
-    TypeVal type() override { return make_int_type(); }
+    TypeVal type() override { return var_type; }
 };
 
 enum class UnOpKind {
@@ -58,6 +60,7 @@ struct UnOpExpr : public Expr {
     ExprVal e;
 
     TypeVal type() override {
+        PhaseTimer timer{Phase::Types};
         TypeVal et = e->type();
         switch (op) {
         case UnOpKind::AddressOf:
@@ -101,6 +104,7 @@ struct BinOpExpr : public Expr {
     ExprVal rhs;
 
     TypeVal type() override {
+        PhaseTimer timer{Phase::Types};
         const TypeVal lt = lhs->type();
         const TypeVal rt = rhs->type();
         switch (op) {
@@ -6,6 +6,8 @@
 #include <memory>
 #include <type_traits>
 
+#include "alloc_trace.h"
+
 namespace detail {
 
 template<class T>
@@ -62,6 +64,7 @@ public:
     poly_value(const poly_value& p) {
         if (!p)
             return;
+        TRACE_ALLOCATIONS(PolyValueCopy);
         ptr = std::unique_ptr<T>(p.cloner->clone(p.ptr.get()));
         cloner = p.cloner->clone();
     }
@@ -73,6 +76,7 @@ public:
 
     template<class U, class V = std::enable_if_t<!std::is_same_v<T, U> && std::is_convertible_v<U*, T*>>>
     poly_value(const poly_value<U>& p) {
+        TRACE_ALLOCATIONS(PolyValueCopy);
         ptr = std::unique_ptr<T>(p.cloner->clone(p.ptr.get()));
         cloner = std::make_unique<detail::delegating_cloner<T, U>>(p.cloner->clone());
     }
@@ -127,6 +131,7 @@ public:
 
 template<class T, class U = T, class... Ts>
 poly_value<T> make_poly_value(Ts&&... ts) {
+    TRACE_ALLOCATIONS(MakePolyValue);
     poly_value<T> result;
     result.cloner = std::make_unique<detail::direct_cloner<T, U>>();
     result.ptr = std::make_unique<U>(std::forward<Ts>(ts)...);
@@ -0,0 +1,678 @@
+// This file is part of the smolcc project
+// SPDX-License-Identifier: MIT
+
+#include "scheduler.h"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <set>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fmt/core.h>
+
+#include "assert.h"
+#include "timing.h"
+
+namespace {
+
+enum class OpClass {
+    Alu,
+    ShiftedAlu,
+    Multiply,
+    MultiplyHigh,
+    Divide,
+    Load,
+    Store,
+    VectorAlu,
+    VectorLoad,
+    VectorStore,
+};
+
+enum class Unit {
+    Alu,
+    Multiply,  // also hosts the divider, which is not pipelined
+    Load,
+    Store,
+    Vector,
+};
+
+struct CpuModel {
+    int issue_width;
+
+    // Pipelines per unit
+    int alu_pipes;
+    int multiply_pipes;
+    int load_pipes;
+    int store_pipes;
+    int vector_pipes;
+
+    // Worst-case latencies of the forms codegen emits
+    int alu;
+    int shifted_alu;
+    int multiply;
+    int multiply_high;
+    int divide;
+    int load;
+    int store;
+    int vector_alu;
+    int vector_load;
+};
+
+struct Instruction {
+    std::vector<std::string> locs;  // .loc directives that precede this instruction
+    std::string mnemonic;
+    std::vector<std::string> operands;
+};
+
+struct MemoryAccess {
+    enum class Region {
+        Frame,    // [fp + offset, fp + offset + size)
+        Stack,    // sp-relative spill slots, always below every local
+        Unknown,  // through a pointer
+    };
+
+    Region region;
+    std::int64_t offset = 0;
+    std::int64_t size = 0;
+    bool is_store;
+};
+
+struct Effects {
+    std::set<std::string> defs;
+    std::set<std::string> uses;
+    std::optional<MemoryAccess> memory;
+    OpClass op_class = OpClass::Alu;
+};
+
+}  // namespace
+
+// From the Arm software optimization guides
+static constexpr CpuModel cortex_a76{
+        .issue_width = 4,
+        .alu_pipes = 3,
+        .multiply_pipes = 1,
+        .load_pipes = 2,
+        .store_pipes = 2,
+        .vector_pipes = 2,
+        .alu = 1,
+        .shifted_alu = 2,
+        .multiply = 2,
+        .multiply_high = 3,
+        .divide = 12,
+        .load = 4,
+        .store = 1,
+        .vector_alu = 2,
+        .vector_load = 6,
+};
+
+static constexpr CpuModel neoverse_n1{
+        .issue_width = 4,
+        .alu_pipes = 3,
+        .multiply_pipes = 1,
+        .load_pipes = 2,
+        .store_pipes = 2,
+        .vector_pipes = 2,
+        .alu = 1,
+        .shifted_alu = 2,
+        .multiply = 2,
+        .multiply_high = 4,
+        .divide = 12,
+        .load = 4,
+        .store = 1,
+        .vector_alu = 2,
+        .vector_load = 6,
+};
+
+// From published microbenchmarks of the Firestorm core
+static constexpr CpuModel apple_m1{
+        .issue_width = 8,
+        .alu_pipes = 6,
+        .multiply_pipes = 2,
+        .load_pipes = 3,
+        .store_pipes = 2,
+        .vector_pipes = 4,
+        .alu = 1,
+        .shifted_alu = 1,
+        .multiply = 3,
+        .multiply_high = 3,
+        .divide = 9,
+        .load = 4,
+        .store = 1,
+        .vector_alu = 2,
+        .vector_load = 5,
+};
+
+static const CpuModel& model(Cpu cpu) {
+    switch (cpu) {
+    case Cpu::CortexA76:
+        return cortex_a76;
+    case Cpu::NeoverseN1:
+        return neoverse_n1;
+    case Cpu::AppleM1:
+        return apple_m1;
+    }
+    ASSERT(!"Unknown cpu");
+    return cortex_a76;
+}
+
+static int latency(const CpuModel& m, OpClass c) {
+    switch (c) {
+    case OpClass::Alu:
+        return m.alu;
+    case OpClass::ShiftedAlu:
+        return m.shifted_alu;
+    case OpClass::Multiply:
+        return m.multiply;
+    case OpClass::MultiplyHigh:
+        return m.multiply_high;
+    case OpClass::Divide:
+        return m.divide;
+    case OpClass::Load:
+        return m.load;
+    case OpClass::Store:
+    case OpClass::VectorStore:
+        return m.store;
+    case OpClass::VectorAlu:
+        return m.vector_alu;
+    case OpClass::VectorLoad:
+        return m.vector_load;
+    }
+    ASSERT(!"Unknown op class");
+    return 1;
+}
+
+static Unit unit(OpClass c) {
+    switch (c) {
+    case OpClass::Alu:
+    case OpClass::ShiftedAlu:
+        return Unit::Alu;
+    case OpClass::Multiply:
+    case OpClass::MultiplyHigh:
+    case OpClass::Divide:
+        return Unit::Multiply;
+    case OpClass::Load:
+    case OpClass::VectorLoad:
+        return Unit::Load;
+    case OpClass::Store:
+    case OpClass::VectorStore:
+        return Unit::Store;
+    case OpClass::VectorAlu:
+        return Unit::Vector;
+    }
+    ASSERT(!"Unknown op class");
+    return Unit::Alu;
+}
+
+static int pipes(const CpuModel& m, Unit u) {
+    switch (u) {
+    case Unit::Alu:
+        return m.alu_pipes;
+    case Unit::Multiply:
+        return m.multiply_pipes;
+    case Unit::Load:
+        return m.load_pipes;
+    case Unit::Store:
+        return m.store_pipes;
+    case Unit::Vector:
+        return m.vector_pipes;
+    }
+    ASSERT(!"Unknown unit");
+    return 1;
+}
+
+// Condition flags are tracked as if they were a register
+static constexpr std::string_view flags = "nzcv";
+
+// Registers codegen never allocates. Renamed temporaries are placed here.
+static constexpr std::array<std::string_view, 5> spare_registers{"x4", "x5", "x6", "x7", "x8"};
+
+static bool is_register(std::string_view token) {
+    if (token == "sp" || token == "fp" || token == "lr")
+        return true;
+    if (token.size() < 2 || (token[0] != 'x' && token[0] != 'w' && token[0] != 'v'))
+        return false;
+    return std::all_of(token.begin() + 1, token.end(), [](char c) { return std::isdigit(c); });
+}
+
+// w registers are views of x registers, so both are tracked under the x name
+static std::string canonical_register(std::string_view reg) {
+    if (reg[0] == 'w')
+        return fmt::format("x{}", reg.substr(1));
+    return std::string{reg};
+}
+
+template<typename F>
+static void for_each_token(std::string_view s, F f) {
+    std::size_t i = 0;
+    while (i < s.size()) {
+        if (!std::isalnum(s[i])) {
+            i++;
+            continue;
+        }
+        std::size_t j = i;
+        while (j < s.size() && (std::isalnum(s[j]) || s[j] == '_'))
+            j++;
+        // Skip arrangement specifiers like the 2d in v24.2d
+        if (i == 0 || s[i - 1] != '.')
+            f(i, s.substr(i, j - i));
+        i = j;
+    }
+}
+
+static std::vector<std::string> registers_in(std::string_view operand) {
+    std::vector<std::string> result;
+    for_each_token(operand, [&](std::size_t, std::string_view token) {
+        if (is_register(token))
+            result.push_back(canonical_register(token));
+    });
+    return result;
+}
+
+static std::string replace_register(std::string_view operand, std::string_view from, std::string_view to) {
+    std::string result;
+    std::size_t last = 0;
+    for_each_token(operand, [&](std::size_t pos, std::string_view token) {
+        if (!is_register(token) || canonical_register(token) != from)
+            return;
+        result += operand.substr(last, pos - last);
+        result += token[0];
+        result += to.substr(1);
+        last = pos + token.size();
+    });
+    result += operand.substr(last);
+    return result;
+}
+
+static bool is_load(std::string_view m) {
+    return m == "ldr" || m == "ldp" || m == "ld1";
+}
+
+static bool is_store(std::string_view m) {
+    return m == "str" || m == "stp" || m == "st1";
+}
+
+static bool is_compare(std::string_view m) {
+    return m == "cmp" || m == "cmn" || m == "tst" || m == "ccmp" || m == "ccmn";
+}
+
+static bool is_terminator(std::string_view m) {
+    return m == "b" || m.starts_with("b.") || m == "cbz" || m == "cbnz" || m == "ret";
+}
+
+static std::optional<std::size_t> memory_operand(const Instruction& inst) {
+    for (std::size_t i = 0; i < inst.operands.size(); i++) {
+        if (inst.operands[i].starts_with('['))
+            return i;
+    }
+    return std::nullopt;
+}
+
+// Whether operand i of inst is written rather than read
+static bool is_def_operand(const Instruction& inst, std::size_t i) {
+    if (is_load(inst.mnemonic))
+        return i < memory_operand(inst).value_or(0);
+    if (is_store(inst.mnemonic) || is_compare(inst.mnemonic) || is_terminator(inst.mnemonic))
+        return false;
+    return i == 0;
+}
+
+static Effects effects(const Instruction& inst) {
+    const std::string& m = inst.mnemonic;
+    Effects e;
+
+    if (is_load(m) || is_store(m)) {
+        const std::size_t mem = memory_operand(inst).value();
+        const bool store = is_store(m);
+
+        for (std::size_t i = 0; i < mem; i++) {
+            for (const std::string& reg : registers_in(inst.operands[i]))
+                (store ? e.uses : e.defs).insert(reg);
+        }
+
+        const std::string& address = inst.operands[mem];
+        const std::vector<std::string> base = registers_in(address);
+        ASSERT(base.size() == 1);
+        e.uses.insert(base[0]);
+        const bool writeback = address.ends_with('!') || mem + 1 < inst.operands.size();
+        if (writeback)
+            e.defs.insert(base[0]);
+
+        MemoryAccess access{.region = MemoryAccess::Region::Unknown, .is_store = store};
+        // Counted by operand, as xzr is not a tracked register
+        access.size = m.ends_with('1') ? 16 : 8 * static_cast<std::int64_t>(mem);
+        if (base[0] == "sp") {
+            access.region = MemoryAccess::Region::Stack;
+        } else if (base[0] == "fp" && !writeback) {
+            access.region = MemoryAccess::Region::Frame;
+            const std::size_t comma = address.find(',');
+            if (comma != std::string::npos)
+                access.offset = std::stoll(address.substr(comma + 1));
+        }
+        e.memory = access;
+
+        if (m == "ld1")
+            e.op_class = OpClass::VectorLoad;
+        else if (m == "st1")
+            e.op_class = OpClass::VectorStore;
+        else
+            e.op_class = store ? OpClass::Store : OpClass::Load;
+        return e;
+    }
+
+    if (is_compare(m)) {
+        for (const std::string& operand : inst.operands) {
+            for (const std::string& reg : registers_in(operand))
+                e.uses.insert(reg);
+        }
+        if (m == "ccmp" || m == "ccmn")
+            e.uses.insert(std::string{flags});
+        e.defs.insert(std::string{flags});
+        return e;
+    }
+
+    if (is_terminator(m)) {
+        for (const std::string& operand : inst.operands) {
+            for (const std::string& reg : registers_in(operand))
+                e.uses.insert(reg);
+        }
+        if (m.starts_with("b."))
+            e.uses.insert(std::string{flags});
+        if (m == "ret")
+            e.uses.insert("lr");
+        return e;
+    }
+
+    for (std::size_t i = 0; i < inst.operands.size(); i++) {
+        for (const std::string& reg : registers_in(inst.operands[i]))
+            (i == 0 ? e.defs : e.uses).insert(reg);
+    }
+    if (m == "movk")
+        e.uses.insert(e.defs.begin(), e.defs.end());
+    if (m.starts_with("cs") || m == "cinc" || m == "cneg")
+        e.uses.insert(std::string{flags});
+    if (m == "adds" || m == "subs" || m == "ands" || m == "negs")
+        e.defs.insert(std::string{flags});
+
+    if (m == "mul" || m == "madd" || m == "msub" || m == "mneg") {
+        e.op_class = OpClass::Multiply;
+    } else if (m == "smulh" || m == "umulh") {
+        e.op_class = OpClass::MultiplyHigh;
+    } else if (m == "sdiv" || m == "udiv") {
+        e.op_class = OpClass::Divide;
+    } else if (!inst.operands.empty() && inst.operands[0].starts_with('v')) {
+        e.op_class = OpClass::VectorAlu;
+    } else if (inst.operands.size() == 4 && (inst.operands[3].starts_with("lsl") || inst.operands[3].starts_with("lsr") || inst.operands[3].starts_with("asr"))) {
+        e.op_class = OpClass::ShiftedAlu;  // add x0, x1, x2, lsl 3
+    }
+    return e;
+}
+
+static bool intersects(const std::set<std::string>& a, const std::set<std::string>& b) {
+    return std::any_of(a.begin(), a.end(), [&](const std::string& x) { return b.contains(x); });
+}
+
+static bool may_alias(const MemoryAccess& a, const MemoryAccess& b) {
+    using Region = MemoryAccess::Region;
+    if (a.region == Region::Unknown || b.region == Region::Unknown)
+        return true;
+    if (a.region != b.region)
+        return false;
+    if (a.region == Region::Stack)
+        return true;
+    return a.offset < b.offset + b.size && b.offset < a.offset + a.size;
+}
+
+// Gives each value that is defined and consumed within the block its own spare register, so that
+// the only dependencies left between instructions are true ones.
+static void rename_temporaries(std::vector<Instruction>& block) {
+    // Index of the last reader of the value each spare register holds
+    std::array<std::optional<std::size_t>, spare_registers.size()> busy_until;
+
+    for (std::size_t i = 0; i < block.size(); i++) {
+        Instruction& def = block[i];
+        if (def.mnemonic == "movk" || def.operands.empty() || !is_def_operand(def, 0))
+            continue;
+        const std::string reg = def.operands[0];
+        if (!reg.starts_with('x') || !is_register(reg))
+            continue;
+        if (std::find(spare_registers.begin(), spare_registers.end(), reg) != spare_registers.end())
+            continue;
+
+        // The value must be overwritten before the end of the block, or it may be live out
+        std::optional<std::size_t> last_use;
+        bool overwritten = false;
+        for (std::size_t j = i + 1; j < block.size(); j++) {
+            const Effects e = effects(block[j]);
+            if (e.uses.contains(reg)) {
+                if (block[j].mnemonic == "movk")
+                    break;
+                last_use = j;
+            }
+            if (e.defs.contains(reg)) {
+                overwritten = true;
+                break;
+            }
+        }
+        if (!overwritten || !last_use)
+            continue;
+
+        std::optional<std::size_t> spare;
+        for (std::size_t k = 0; k < spare_registers.size(); k++) {
+            if (busy_until[k] && *busy_until[k] > i)
+                continue;
+            if (!spare || (busy_until[k].value_or(0) < busy_until[*spare].value_or(0)))
+                spare = k;
+        }
+        if (!spare)
+            continue;
+
+        const std::string_view to = spare_registers[*spare];
+        def.operands[0] = std::string{to};
+        for (std::size_t j = i + 1; j <= *last_use; j++) {
+            for (std::size_t k = 0; k < block[j].operands.size(); k++) {
+                if (!is_def_operand(block[j], k))
+                    block[j].operands[k] = replace_register(block[j].operands[k], reg, to);
+            }
+        }
+        busy_until[*spare] = *last_use;
+    }
+}
+
+// Critical-path list scheduling: each cycle issues up to issue_width ready instructions, tallest
+// first, as long as a pipeline of the right unit is free.
+static std::vector<Instruction> list_schedule(std::vector<Instruction> block, const CpuModel& m) {
+    const std::size_t n = block.size();
+    std::vector<Effects> e;
+    for (const Instruction& inst : block)
+        e.push_back(effects(inst));
+
+    struct Edge {
+        std::size_t to;
+        int latency;
+    };
+    std::vector<std::vector<Edge>> succs(n);
+    std::vector<int> pred_count(n);
+    for (std::size_t j = 0; j < n; j++) {
+        for (std::size_t i = 0; i < j; i++) {
+            std::optional<int> edge;
+            if (intersects(e[i].defs, e[j].uses))
+                edge = latency(m, e[i].op_class);
+            else if (intersects(e[i].defs, e[j].defs))
+                edge = 1;
+            else if (intersects(e[i].uses, e[j].defs))
+                edge = 0;
+            if (e[i].memory && e[j].memory && (e[i].memory->is_store || e[j].memory->is_store) && may_alias(*e[i].memory, *e[j].memory))
+                edge = std::max(edge.value_or(0), e[i].memory->is_store ? latency(m, e[i].op_class) : 0);
+            // Memory below sp may be clobbered asynchronously, so no access crosses a frame
+            // allocation or teardown. Pushes and pops stay below every local.
+            auto adjusts_frame = [](const Effects& x) { return x.defs.contains("sp") && !x.memory; };
+            if ((adjusts_frame(e[i]) && e[j].memory) || (e[i].memory && adjusts_frame(e[j])))
+                edge = std::max(edge.value_or(0), 0);
+            if (edge) {
+                succs[i].push_back({j, *edge});
+                pred_count[j]++;
+            }
+        }
+    }
+
+    std::vector<int> height(n);
+    for (std::size_t i = n; i-- > 0;) {
+        height[i] = latency(m, e[i].op_class);
+        for (const Edge& s : succs[i])
+            height[i] = std::max(height[i], s.latency + height[s.to]);
+    }
+
+    std::vector<int> ready_at(n);
+    std::vector<bool> issued(n);
+    std::array<std::vector<int>, 5> pipe_free_at;
+    for (Unit u : {Unit::Alu, Unit::Multiply, Unit::Load, Unit::Store, Unit::Vector})
+        pipe_free_at[static_cast<std::size_t>(u)].assign(pipes(m, u), 0);
+
+    std::vector<Instruction> result;
+    for (int cycle = 0; result.size() < n; cycle++) {
+        for (int slot = 0; slot < m.issue_width; slot++) {
+            std::optional<std::size_t> best;
+            int* best_pipe = nullptr;
+            for (std::size_t i = 0; i < n; i++) {
+                if (issued[i] || pred_count[i] != 0 || ready_at[i] > cycle)
+                    continue;
+                if (best && height[i] <= height[*best])
+                    continue;
+                std::vector<int>& unit_pipes = pipe_free_at[static_cast<std::size_t>(unit(e[i].op_class))];
+                auto pipe = std::find_if(unit_pipes.begin(), unit_pipes.end(), [&](int t) { return t <= cycle; });
+                if (pipe == unit_pipes.end())
+                    continue;
+                best = i;
+                best_pipe = &*pipe;
+            }
+            if (!best)
+                break;
+
+            issued[*best] = true;
+            *best_pipe = cycle + (e[*best].op_class == OpClass::Divide ? m.divide : 1);
+            for (const Edge& s : succs[*best]) {
+                ready_at[s.to] = std::max(ready_at[s.to], cycle + s.latency);
+                pred_count[s.to]--;
+            }
+            result.push_back(std::move(block[*best]));
+        }
+    }
+    return result;
+}
+
+static std::string_view trim(std::string_view s) {
+    while (!s.empty() && std::isspace(s.front()))
+        s.remove_prefix(1);
+    while (!s.empty() && std::isspace(s.back()))
+        s.remove_suffix(1);
+    return s;
+}
+
+static Instruction parse_instruction(std::string_view line) {
+    Instruction inst;
+    const std::size_t space = line.find(' ');
+    inst.mnemonic = line.substr(0, space);
+    if (space == std::string_view::npos)
+        return inst;
+
+    const std::string_view rest = line.substr(space + 1);
+    int depth = 0;
+    std::size_t start = 0;
+    for (std::size_t i = 0; i <= rest.size(); i++) {
+        if (i == rest.size() || (rest[i] == ',' && depth == 0)) {
+            inst.operands.emplace_back(trim(rest.substr(start, i - start)));
+            start = i + 1;
+        } else if (rest[i] == '[' || rest[i] == '{') {
+            depth++;
+        } else if (rest[i] == ']' || rest[i] == '}') {
+            depth--;
+        }
+    }
+    return inst;
+}
+
+std::optional<Cpu> parse_cpu(std::string_view name) {
+    if (name == "cortex-a76")
+        return Cpu::CortexA76;
+    if (name == "neoverse-n1")
+        return Cpu::NeoverseN1;
+    if (name == "apple-m1")
+        return Cpu::AppleM1;
+    return std::nullopt;
+}
+
+std::string schedule(std::string_view assembly, Cpu cpu) {
+    PhaseTimer timer{Phase::Schedule};
+    const CpuModel& m = model(cpu);
+
+    std::string out;
+    std::vector<Instruction> block;
+    std::vector<std::string> locs;
+
+    auto emit = [&](const Instruction& inst) {
+        for (const std::string& loc : inst.locs)
+            out += loc + "\n";
+        out += inst.mnemonic;
+        for (std::size_t i = 0; i < inst.operands.size(); i++)
+            out += (i == 0 ? " " : ", ") + inst.operands[i];
+        out += "\n";
+    };
+
+    auto flush = [&] {
+        if (block.empty())
+            return;
+        rename_temporaries(block);
+        std::optional<Instruction> terminator;
+        if (is_terminator(block.back().mnemonic)) {
+            terminator = std::move(block.back());
+            block.pop_back();
+        }
+        for (const Instruction& inst : list_schedule(std::move(block), m))
+            emit(inst);
+        if (terminator)
+            emit(*terminator);
+        block.clear();
+    };
+
+    while (!assembly.empty()) {
+        const std::size_t newline = assembly.find('\n');
+        const std::string_view line = trim(assembly.substr(0, newline));
+        assembly.remove_prefix(newline == std::string_view::npos ? assembly.size() : newline + 1);
+        if (line.empty())
+            continue;
+
+        if (line.starts_with(".loc ")) {
+            locs.emplace_back(line);
+            continue;
+        }
+
+        // Labels, directives, calls and system calls delimit blocks and stay in place
+        if (line.ends_with(':') || line.starts_with('.') || line.starts_with("bl ") || line.starts_with("svc ")) {
+            flush();
+            for (const std::string& loc : locs)
+                out += loc + "\n";
+            locs.clear();
+            out += fmt::format("{}\n", line);
+            continue;
+        }
+
+        Instruction inst = parse_instruction(line);
+        inst.locs = std::move(locs);
+        locs.clear();
+        const bool ends_block = is_terminator(inst.mnemonic);
+        block.push_back(std::move(inst));
+        if (ends_block)
+            flush();
+    }
+    flush();
+    for (const std::string& loc : locs)
+        out += loc + "\n";
+
+    return out;
+}
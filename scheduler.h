@@ -0,0 +1,22 @@
+// This file is part of the smolcc project
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <optional>
+#include <string>
+#include <string_view>
+
+// Cores with a scheduling model, selected with -mcpu=
+enum class Cpu {
+    CortexA76,
+    NeoverseN1,
+    AppleM1,
+};
+
+std::optional<Cpu> parse_cpu(std::string_view name);
+
+// List-schedules each basic block of `assembly` against the latencies and pipelines of `cpu`.
+// Block-local temporaries are first renamed onto spare scratch registers, so values funnelled
+// through x0 no longer serialise otherwise independent work.
+std::string schedule(std::string_view assembly, Cpu cpu);
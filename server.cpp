@@ -0,0 +1,147 @@
+// This file is part of the smolcc project
+// SPDX-License-Identifier: MIT
+
+#include "server.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <fmt/core.h>
+
+#include "assert.h"
+#include "cache.h"
+#include "driver.h"
+
+namespace {
+
+struct Request {
+    std::uint64_t id;
+    std::vector<std::string> args;
+};
+
+}  // namespace
+
+// Outputs kept in memory before the table is cleared
+static constexpr std::size_t max_memo_entries = 4096;
+
+static bool read_request(std::istream& in, Request& request) {
+    std::size_t count;
+    if (!(in >> request.id))
+        return false;
+    ASSERT(in >> count && in.get() == '\n');
+
+    request.args.clear();
+    for (std::size_t i = 0; i < count; i++) {
+        std::size_t length;
+        ASSERT(in >> length && in.get() == '\n');
+        std::string arg(length, '\0');
+        ASSERT(in.read(arg.data(), length));
+        request.args.push_back(std::move(arg));
+    }
+    return true;
+}
+
+void serve(std::string_view stamp, std::istream& in, std::ostream& out) {
+    std::mutex queue_mutex;
+    std::condition_variable queue_ready;
+    std::deque<Request> queue;
+    bool done = false;
+
+    std::mutex memo_mutex;
+    std::unordered_map<std::string, std::string> memo;
+
+    std::mutex out_mutex;
+
+    auto worker = [&] {
+        // A request that fails to compile gets an error response instead of ending the server
+        assert_throws = true;
+        while (true) {
+            Request request;
+            {
+                std::unique_lock lock{queue_mutex};
+                queue_ready.wait(lock, [&] { return done || !queue.empty(); });
+                if (queue.empty())
+                    return;
+                request = std::move(queue.front());
+                queue.pop_front();
+            }
+
+            std::optional<std::string> output;
+            std::string error;
+            try {
+                const std::vector<std::string_view> args(request.args.begin(), request.args.end());
+                const Invocation inv = parse_invocation(stamp, args);
+                // The memo first, then the disk cache, then a compile. The output is then kept in
+                // the memo, and a fresh compile also in the disk cache.
+                {
+                    std::lock_guard lock{memo_mutex};
+                    if (auto it = memo.find(inv.key); it != memo.end())
+                        output = it->second;
+                }
+                if (!output) {
+                    std::optional<CompileCache> cache;
+                    if (inv.cache_dir) {
+                        cache.emplace(*inv.cache_dir);
+                        output = cache->lookup(inv.key);
+                    }
+                    if (!output) {
+                        output = compile_uncached(inv);
+                        if (cache)
+                            cache->store(inv.key, *output);
+                    }
+                    std::lock_guard lock{memo_mutex};
+                    if (memo.size() >= max_memo_entries)
+                        memo.clear();
+                    memo.emplace(inv.key, *output);
+                }
+            } catch (const AssertionFailure& e) {
+                error = fmt::format("{}\n", e.what());
+            }
+
+            std::lock_guard lock{out_mutex};
+            if (output)
+                out << request.id << ' ' << output->size() << '\n'
+                    << *output;
+            else
+                out << request.id << " error " << error.size() << '\n'
+                    << error;
+            out.flush();
+        }
+    };
+
+    std::vector<std::jthread> workers;
+    for (unsigned i = 0; i < std::max(1u, std::thread::hardware_concurrency()); i++)
+        workers.emplace_back(worker);
+
+    // A malformed frame leaves the stream out of sync, so it ends the session after the requests
+    // already read have been answered
+    assert_throws = true;
+    try {
+        Request request;
+        while (read_request(in, request)) {
+            {
+                std::lock_guard lock{queue_mutex};
+                queue.push_back(std::move(request));
+            }
+            queue_ready.notify_one();
+        }
+    } catch (const AssertionFailure& e) {
+        fmt::print(stderr, "malformed request: {}\n", e.what());
+    }
+    assert_throws = false;
+
+    {
+        std::lock_guard lock{queue_mutex};
+        done = true;
+    }
+    queue_ready.notify_all();
+}
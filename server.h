@@ -0,0 +1,28 @@
+// This file is part of the smolcc project
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <istream>
+#include <ostream>
+#include <string_view>
+
+// Serves compile requests read from in until it ends, writing responses to out. A request is
+//
+//     <id> <count>\n
+//
+// followed by count arguments, each framed as <length>\n<bytes>. The arguments are those of a
+// command-line compile: [options] source. The response is
+//
+//     <id> <length>\n<assembly>
+//
+// or, if the request does not compile,
+//
+//     <id> error <length>\n<message>
+//
+// Diagnostics never go to out. A malformed frame ends the session once earlier requests have been
+// answered.
+//
+// Requests are compiled concurrently, so responses may arrive in any order. Identical requests are
+// answered from memory.
+void serve(std::string_view stamp, std::istream& in, std::ostream& out);
@@ -0,0 +1,824 @@
+// This file is part of the smolcc project
+// SPDX-License-Identifier: MIT
+
+#include "simulator.h"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "assert.h"
+
+namespace {
+
+enum class Op {
+    Movz,
+    Movn,
+    Movk,
+    Mov,
+    Orr,
+    And,
+    Eor,
+    Add,
+    Sub,
+    Neg,
+    Mul,
+    Madd,
+    Msub,
+    Sdiv,
+    Smulh,
+    Asr,
+    Lsl,
+    Lsr,
+    Cmp,
+    Cmn,
+    Ccmp,
+    Ccmn,
+    Cset,
+    Csel,
+    Csinc,
+    Csneg,
+    Ldr,
+    Str,
+    Ldp,
+    Stp,
+    Ld1,
+    St1,
+    Dup,
+    B,
+    BCond,
+    Cbz,
+    Cbnz,
+    Bl,
+    Ret,
+    Svc,
+};
+
+enum class Cond {
+    Eq,
+    Ne,
+    Hs,
+    Lo,
+    Mi,
+    Pl,
+    Hi,
+    Ls,
+    Ge,
+    Lt,
+    Gt,
+    Le,
+};
+
+enum class Addressing {
+    Offset,
+    PreIndex,
+    PostIndex,
+};
+
+struct Operand {
+    enum class Kind {
+        Register,
+        VectorRegister,
+        Immediate,
+        Memory,
+        Shift,
+        Condition,
+        Label,
+    } kind;
+
+    int reg = 0;           // Register, VectorRegister, Memory base
+    std::int64_t imm = 0;  // Immediate, Memory offset or writeback, Shift amount
+    Op shift = Op::Lsl;
+    Cond cond = Cond::Eq;
+    Addressing addressing = Addressing::Offset;
+    std::string label;
+};
+
+struct Instruction {
+    Op op;
+    std::vector<Operand> operands;
+    std::size_t target = 0;  // Resolved branch target
+    int latency;
+};
+
+// Register numbering: x0-x30, then sp, then xzr
+constexpr int reg_fp = 29;
+constexpr int reg_lr = 30;
+constexpr int reg_sp = 31;
+constexpr int reg_zr = 32;
+constexpr int num_x = 33;
+
+// Scoreboard slots: general registers, vector registers, then the flags
+constexpr int slot_v = num_x;
+constexpr int slot_flags = slot_v + 32;
+constexpr int num_slots = slot_flags + 1;
+
+// Pipeline model
+constexpr int alu_latency = 1;
+constexpr int shifted_alu_latency = 2;
+constexpr int multiply_latency = 3;
+constexpr int multiply_high_latency = 4;
+constexpr int divide_latency = 12;
+constexpr int load_latency = 4;
+constexpr int vector_latency = 2;
+constexpr int vector_load_latency = 5;
+constexpr int taken_branch_penalty = 1;
+
+constexpr std::uint64_t initial_sp = 0x7fff0000;
+constexpr std::uint64_t return_sentinel = 0xdead0000;
+constexpr std::uint64_t step_limit = std::uint64_t{1} << 32;
+
+}  // namespace
+
+static std::string_view trim(std::string_view s) {
+    while (!s.empty() && std::isspace(s.front()))
+        s.remove_prefix(1);
+    while (!s.empty() && std::isspace(s.back()))
+        s.remove_suffix(1);
+    return s;
+}
+
+static std::optional<std::int64_t> parse_integer(std::string_view s) {
+    const bool negative = s.starts_with('-');
+    if (negative)
+        s.remove_prefix(1);
+    int base = 10;
+    if (s.starts_with("0x")) {
+        s.remove_prefix(2);
+        base = 16;
+    }
+    std::uint64_t value;
+    const auto [end, ec] = std::from_chars(s.data(), s.data() + s.size(), value, base);
+    if (s.empty() || ec != std::errc{} || end != s.data() + s.size())
+        return std::nullopt;
+    return static_cast<std::int64_t>(negative ? 0 - value : value);
+}
+
+static std::optional<int> parse_register(std::string_view s) {
+    if (s == "fp")
+        return reg_fp;
+    if (s == "lr")
+        return reg_lr;
+    if (s == "sp")
+        return reg_sp;
+    if (s == "xzr")
+        return reg_zr;
+    if (s.size() < 2 || s[0] != 'x')
+        return std::nullopt;
+    const std::optional<std::int64_t> n = parse_integer(s.substr(1));
+    if (!n || *n < 0 || *n > 30)
+        return std::nullopt;
+    return static_cast<int>(*n);
+}
+
+static std::optional<Cond> parse_cond(std::string_view s) {
+    static constexpr std::array<std::pair<std::string_view, Cond>, 14> conds{{
+            {"eq", Cond::Eq},
+            {"ne", Cond::Ne},
+            {"hs", Cond::Hs},
+            {"cs", Cond::Hs},
+            {"lo", Cond::Lo},
+            {"cc", Cond::Lo},
+            {"mi", Cond::Mi},
+            {"pl", Cond::Pl},
+            {"hi", Cond::Hi},
+            {"ls", Cond::Ls},
+            {"ge", Cond::Ge},
+            {"lt", Cond::Lt},
+            {"gt", Cond::Gt},
+            {"le", Cond::Le},
+    }};
+    for (const auto& [name, cond] : conds) {
+        if (s == name)
+            return cond;
+    }
+    return std::nullopt;
+}
+
+static Operand parse_operand(std::string_view s) {
+    Operand o{};
+    if (s.starts_with('{') && s.ends_with('}'))
+        s = trim(s.substr(1, s.size() - 2));
+
+    if (s.starts_with('[')) {
+        o.kind = Operand::Kind::Memory;
+        if (s.ends_with('!')) {
+            o.addressing = Addressing::PreIndex;
+            s.remove_suffix(1);
+        }
+        ASSERT(s.ends_with(']'));
+        s = s.substr(1, s.size() - 2);
+        const std::size_t comma = s.find(',');
+        const std::optional<int> base = parse_register(trim(s.substr(0, comma)));
+        ASSERT(base);
+        o.reg = *base;
+        if (comma != std::string_view::npos) {
+            const std::optional<std::int64_t> offset = parse_integer(trim(s.substr(comma + 1)));
+            ASSERT(offset);
+            o.imm = *offset;
+        }
+        return o;
+    }
+
+    if (s.size() > 1 && s[0] == 'v' && std::isdigit(s[1])) {
+        o.kind = Operand::Kind::VectorRegister;
+        const std::optional<std::int64_t> n = parse_integer(s.substr(1, s.find('.') - 1));
+        ASSERT(n && *n >= 0 && *n < 32);
+        o.reg = static_cast<int>(*n);
+        return o;
+    }
+
+    if (const std::optional<int> reg = parse_register(s)) {
+        o.kind = Operand::Kind::Register;
+        o.reg = *reg;
+        return o;
+    }
+
+    if (const std::optional<std::int64_t> imm = parse_integer(s)) {
+        o.kind = Operand::Kind::Immediate;
+        o.imm = *imm;
+        return o;
+    }
+
+    for (const auto& [name, op] : {std::pair{"lsl ", Op::Lsl}, std::pair{"lsr ", Op::Lsr}, std::pair{"asr ", Op::Asr}}) {
+        if (s.starts_with(name)) {
+            const std::optional<std::int64_t> amount = parse_integer(trim(s.substr(4)));
+            ASSERT(amount && *amount >= 0 && *amount < 64);
+            o.kind = Operand::Kind::Shift;
+            o.shift = op;
+            o.imm = *amount;
+            return o;
+        }
+    }
+
+    if (const std::optional<Cond> cond = parse_cond(s)) {
+        o.kind = Operand::Kind::Condition;
+        o.cond = *cond;
+        return o;
+    }
+
+    o.kind = Operand::Kind::Label;
+    o.label = s;
+    return o;
+}
+
+static Op parse_op(std::string_view m) {
+    static const std::unordered_map<std::string_view, Op> ops{
+            {"movz", Op::Movz},
+            {"movn", Op::Movn},
+            {"movk", Op::Movk},
+            {"mov", Op::Mov},
+            {"orr", Op::Orr},
+            {"and", Op::And},
+            {"eor", Op::Eor},
+            {"add", Op::Add},
+            {"sub", Op::Sub},
+            {"neg", Op::Neg},
+            {"mul", Op::Mul},
+            {"madd", Op::Madd},
+            {"msub", Op::Msub},
+            {"sdiv", Op::Sdiv},
+            {"smulh", Op::Smulh},
+            {"asr", Op::Asr},
+            {"lsl", Op::Lsl},
+            {"lsr", Op::Lsr},
+            {"cmp", Op::Cmp},
+            {"cmn", Op::Cmn},
+            {"ccmp", Op::Ccmp},
+            {"ccmn", Op::Ccmn},
+            {"cset", Op::Cset},
+            {"csel", Op::Csel},
+            {"csinc", Op::Csinc},
+            {"csneg", Op::Csneg},
+            {"ldr", Op::Ldr},
+            {"str", Op::Str},
+            {"ldp", Op::Ldp},
+            {"stp", Op::Stp},
+            {"ld1", Op::Ld1},
+            {"st1", Op::St1},
+            {"dup", Op::Dup},
+            {"b", Op::B},
+            {"cbz", Op::Cbz},
+            {"cbnz", Op::Cbnz},
+            {"bl", Op::Bl},
+            {"ret", Op::Ret},
+            {"svc", Op::Svc},
+    };
+    if (m.starts_with("b."))
+        return Op::BCond;
+    const auto it = ops.find(m);
+    ASSERT(it != ops.end());
+    return it->second;
+}
+
+static int latency(const Instruction& inst) {
+    const bool vector = !inst.operands.empty() && inst.operands[0].kind == Operand::Kind::VectorRegister;
+    const bool shifted = !inst.operands.empty() && inst.operands.back().kind == Operand::Kind::Shift;
+    switch (inst.op) {
+    case Op::Mul:
+    case Op::Madd:
+    case Op::Msub:
+        return multiply_latency;
+    case Op::Smulh:
+        return multiply_high_latency;
+    case Op::Sdiv:
+        return divide_latency;
+    case Op::Ldr:
+    case Op::Ldp:
+        return load_latency;
+    case Op::Ld1:
+        return vector_load_latency;
+    case Op::Dup:
+        return vector_latency;
+    default:
+        if (vector)
+            return vector_latency;
+        return shifted ? shifted_alu_latency : alu_latency;
+    }
+}
+
+static Instruction parse_instruction(std::string_view line) {
+    const std::size_t space = line.find(' ');
+    Instruction inst{parse_op(line.substr(0, space)), {}, 0, 0};
+    if (inst.op == Op::BCond) {
+        const std::optional<Cond> cond = parse_cond(line.substr(2, space - 2));
+        ASSERT(cond);
+        Operand o{};
+        o.kind = Operand::Kind::Condition;
+        o.cond = *cond;
+        inst.operands.push_back(o);
+    }
+
+    if (space != std::string_view::npos) {
+        const std::string_view rest = line.substr(space + 1);
+        int depth = 0;
+        std::size_t start = 0;
+        for (std::size_t i = 0; i <= rest.size(); i++) {
+            if (i == rest.size() || (rest[i] == ',' && depth == 0)) {
+                inst.operands.push_back(parse_operand(trim(rest.substr(start, i - start))));
+                start = i + 1;
+            } else if (rest[i] == '[' || rest[i] == '{') {
+                depth++;
+            } else if (rest[i] == ']' || rest[i] == '}') {
+                depth--;
+            }
+        }
+    }
+
+    // A post-index writeback follows the memory operand: [sp], 16
+    if (inst.operands.size() >= 2 && inst.operands[inst.operands.size() - 2].kind == Operand::Kind::Memory && inst.operands.back().kind == Operand::Kind::Immediate) {
+        Operand& mem = inst.operands[inst.operands.size() - 2];
+        mem.addressing = Addressing::PostIndex;
+        mem.imm = inst.operands.back().imm;
+        inst.operands.pop_back();
+    }
+
+    inst.latency = latency(inst);
+    return inst;
+}
+
+namespace {
+
+class Machine {
+public:
+    Machine(std::vector<Instruction> program, std::size_t entry)
+            : program(std::move(program)), pc(entry) {
+        x[reg_sp] = initial_sp;
+        x[reg_lr] = return_sentinel;
+    }
+
+    SimulationResult run();
+
+private:
+    // Reads and writes go through the scoreboard: every read of an instruction precedes its writes,
+    // so the issue cycle is final by the time a result's ready cycle is computed
+    std::uint64_t read(int reg) {
+        wait(reg);
+        return reg == reg_zr ? 0 : x[reg];
+    }
+    void write(int reg, std::uint64_t value) {
+        if (reg == reg_zr)
+            return;
+        x[reg] = value;
+        ready[reg] = issue + program[pc].latency;
+    }
+    std::array<std::uint64_t, 2> read_vector(int reg) {
+        wait(slot_v + reg);
+        return v[reg];
+    }
+    void write_vector(int reg, std::array<std::uint64_t, 2> value) {
+        v[reg] = value;
+        ready[slot_v + reg] = issue + program[pc].latency;
+    }
+    bool read_cond(Cond cond) {
+        wait(slot_flags);
+        return holds(cond);
+    }
+    void write_flags(bool n_, bool z_, bool c_, bool v_) {
+        n = n_;
+        z = z_;
+        c = c_;
+        v_flag = v_;
+        ready[slot_flags] = issue + program[pc].latency;
+    }
+    void wait(int slot) { issue = std::max(issue, ready[slot]); }
+
+    bool holds(Cond cond) const;
+    std::uint64_t value(const std::vector<Operand>& ops, std::size_t i);
+    std::uint64_t address(const Operand& mem);
+    void writeback(const Operand& mem, std::uint64_t base);
+    void compare(std::uint64_t a, std::uint64_t b, bool negate);
+
+    std::uint64_t load(std::uint64_t addr) const;
+    void store(std::uint64_t addr, std::uint64_t value);
+
+    std::vector<Instruction> program;
+    std::size_t pc;
+
+    std::array<std::uint64_t, num_x> x{};
+    std::array<std::array<std::uint64_t, 2>, 32> v{};
+    bool n = false, z = false, c = false, v_flag = false;
+    std::unordered_map<std::uint64_t, std::uint8_t> memory;
+
+    std::array<std::uint64_t, num_slots> ready{};
+    std::uint64_t issue = 0;
+    SimulationStats stats;
+};
+
+}  // namespace
+
+bool Machine::holds(Cond cond) const {
+    switch (cond) {
+    case Cond::Eq:
+        return z;
+    case Cond::Ne:
+        return !z;
+    case Cond::Hs:
+        return c;
+    case Cond::Lo:
+        return !c;
+    case Cond::Mi:
+        return n;
+    case Cond::Pl:
+        return !n;
+    case Cond::Hi:
+        return c && !z;
+    case Cond::Ls:
+        return !c || z;
+    case Cond::Ge:
+        return n == v_flag;
+    case Cond::Lt:
+        return n != v_flag;
+    case Cond::Gt:
+        return !z && n == v_flag;
+    case Cond::Le:
+        return z || n != v_flag;
+    }
+    return false;
+}
+
+// The value of a register or immediate operand, shifted if a shift operand follows it
+std::uint64_t Machine::value(const std::vector<Operand>& ops, std::size_t i) {
+    std::uint64_t result = ops[i].kind == Operand::Kind::Register ? read(ops[i].reg) : ops[i].imm;
+    if (i + 1 < ops.size() && ops[i + 1].kind == Operand::Kind::Shift) {
+        const int amount = static_cast<int>(ops[i + 1].imm);
+        switch (ops[i + 1].shift) {
+        case Op::Lsl:
+            result <<= amount;
+            break;
+        case Op::Lsr:
+            result >>= amount;
+            break;
+        default:
+            result = static_cast<std::uint64_t>(static_cast<std::int64_t>(result) >> amount);
+            break;
+        }
+    }
+    return result;
+}
+
+std::uint64_t Machine::address(const Operand& mem) {
+    const std::uint64_t base = read(mem.reg);
+    return mem.addressing == Addressing::PostIndex ? base : base + mem.imm;
+}
+
+void Machine::writeback(const Operand& mem, std::uint64_t base) {
+    if (mem.addressing != Addressing::Offset) {
+        x[mem.reg] = base + mem.imm;
+        ready[mem.reg] = issue + alu_latency;
+    }
+}
+
+// Sets the flags for a - b, or a + b when negate
+void Machine::compare(std::uint64_t a, std::uint64_t b, bool negate) {
+    if (negate) {
+        const std::uint64_t r = a + b;
+        write_flags(r >> 63, r == 0, r < a, (~(a ^ b) & (a ^ r)) >> 63);
+    } else {
+        const std::uint64_t r = a - b;
+        write_flags(r >> 63, r == 0, a >= b, ((a ^ b) & (a ^ r)) >> 63);
+    }
+}
+
+std::uint64_t Machine::load(std::uint64_t addr) const {
+    std::uint64_t value = 0;
+    for (int i = 0; i < 8; i++) {
+        const auto it = memory.find(addr + i);
+        value |= std::uint64_t{it == memory.end() ? std::uint8_t{0} : it->second} << (8 * i);
+    }
+    return value;
+}
+
+void Machine::store(std::uint64_t addr, std::uint64_t value) {
+    for (int i = 0; i < 8; i++)
+        memory[addr + i] = static_cast<std::uint8_t>(value >> (8 * i));
+}
+
+SimulationResult Machine::run() {
+    while (true) {
+        ASSERT(pc < program.size());
+        ASSERT(stats.instructions < step_limit);
+        const Instruction& inst = program[pc];
+        const std::vector<Operand>& ops = inst.operands;
+        const bool vector = !ops.empty() && ops[0].kind == Operand::Kind::VectorRegister;
+        std::optional<std::size_t> branch;
+
+        stats.instructions++;
+        issue = stats.cycles + 1;
+
+        switch (inst.op) {
+        case Op::Movz:
+            write(ops[0].reg, value(ops, 1));
+            break;
+        case Op::Movn:
+            write(ops[0].reg, ~value(ops, 1));
+            break;
+        case Op::Movk: {
+            const int shift = ops.size() > 2 ? static_cast<int>(ops[2].imm) : 0;
+            const std::uint64_t old = read(ops[0].reg);
+            write(ops[0].reg, (old & ~(std::uint64_t{0xffff} << shift)) | (static_cast<std::uint64_t>(ops[1].imm) << shift));
+            break;
+        }
+        case Op::Mov:
+            ASSERT(!vector);
+            write(ops[0].reg, value(ops, 1));
+            break;
+        case Op::Orr:
+        case Op::And:
+        case Op::Eor:
+        case Op::Add:
+        case Op::Sub: {
+            auto apply = [op = inst.op](std::uint64_t a, std::uint64_t b) {
+                switch (op) {
+                case Op::Orr:
+                    return a | b;
+                case Op::And:
+                    return a & b;
+                case Op::Eor:
+                    return a ^ b;
+                case Op::Add:
+                    return a + b;
+                default:
+                    return a - b;
+                }
+            };
+            if (vector) {
+                const auto a = read_vector(ops[1].reg);
+                const auto b = read_vector(ops[2].reg);
+                write_vector(ops[0].reg, {apply(a[0], b[0]), apply(a[1], b[1])});
+            } else {
+                const std::uint64_t a = read(ops[1].reg);
+                write(ops[0].reg, apply(a, value(ops, 2)));
+            }
+            break;
+        }
+        case Op::Neg:
+            if (vector) {
+                const auto a = read_vector(ops[1].reg);
+                write_vector(ops[0].reg, {0 - a[0], 0 - a[1]});
+            } else {
+                write(ops[0].reg, 0 - value(ops, 1));
+            }
+            break;
+        case Op::Mul: {
+            const std::uint64_t a = read(ops[1].reg);
+            write(ops[0].reg, a * read(ops[2].reg));
+            break;
+        }
+        case Op::Madd:
+        case Op::Msub: {
+            const std::uint64_t a = read(ops[1].reg);
+            const std::uint64_t b = read(ops[2].reg);
+            const std::uint64_t acc = read(ops[3].reg);
+            write(ops[0].reg, inst.op == Op::Madd ? acc + a * b : acc - a * b);
+            break;
+        }
+        case Op::Sdiv: {
+            const auto a = static_cast<std::int64_t>(read(ops[1].reg));
+            const auto b = static_cast<std::int64_t>(read(ops[2].reg));
+            std::int64_t q;
+            if (b == 0)
+                q = 0;
+            else if (a == std::numeric_limits<std::int64_t>::min() && b == -1)
+                q = a;
+            else
+                q = a / b;
+            write(ops[0].reg, static_cast<std::uint64_t>(q));
+            break;
+        }
+        case Op::Smulh: {
+            const auto a = static_cast<std::int64_t>(read(ops[1].reg));
+            const auto b = static_cast<std::int64_t>(read(ops[2].reg));
+            write(ops[0].reg, static_cast<std::uint64_t>((static_cast<__int128>(a) * b) >> 64));
+            break;
+        }
+        case Op::Asr:
+        case Op::Lsl:
+        case Op::Lsr: {
+            const std::uint64_t a = read(ops[1].reg);
+            const int amount = static_cast<int>(value(ops, 2) & 63);
+            if (inst.op == Op::Asr)
+                write(ops[0].reg, static_cast<std::uint64_t>(static_cast<std::int64_t>(a) >> amount));
+            else
+                write(ops[0].reg, inst.op == Op::Lsl ? a << amount : a >> amount);
+            break;
+        }
+        case Op::Cmp:
+        case Op::Cmn: {
+            const std::uint64_t a = read(ops[0].reg);
+            compare(a, value(ops, 1), inst.op == Op::Cmn);
+            break;
+        }
+        case Op::Ccmp:
+        case Op::Ccmn: {
+            const std::uint64_t a = read(ops[0].reg);
+            const std::uint64_t b = value(ops, 1);
+            if (read_cond(ops[3].cond)) {
+                compare(a, b, inst.op == Op::Ccmn);
+            } else {
+                const std::int64_t nzcv = ops[2].imm;
+                write_flags(nzcv & 8, nzcv & 4, nzcv & 2, nzcv & 1);
+            }
+            break;
+        }
+        case Op::Cset:
+            write(ops[0].reg, read_cond(ops[1].cond) ? 1 : 0);
+            break;
+        case Op::Csel:
+        case Op::Csinc:
+        case Op::Csneg: {
+            const std::uint64_t a = read(ops[1].reg);
+            const std::uint64_t b = read(ops[2].reg);
+            std::uint64_t result = a;
+            if (!read_cond(ops[3].cond))
+                result = inst.op == Op::Csel ? b : inst.op == Op::Csinc ? b + 1 : 0 - b;
+            write(ops[0].reg, result);
+            break;
+        }
+        case Op::Ldr: {
+            const std::uint64_t addr = address(ops[1]);
+            const std::uint64_t base = read(ops[1].reg);
+            stats.loads++;
+            write(ops[0].reg, load(addr));
+            writeback(ops[1], base);
+            break;
+        }
+        case Op::Str: {
+            const std::uint64_t value = read(ops[0].reg);
+            const std::uint64_t addr = address(ops[1]);
+            const std::uint64_t base = read(ops[1].reg);
+            stats.stores++;
+            store(addr, value);
+            writeback(ops[1], base);
+            break;
+        }
+        case Op::Ldp: {
+            const std::uint64_t addr = address(ops[2]);
+            const std::uint64_t base = read(ops[2].reg);
+            stats.loads++;
+            write(ops[0].reg, load(addr));
+            write(ops[1].reg, load(addr + 8));
+            writeback(ops[2], base);
+            break;
+        }
+        case Op::Stp: {
+            const std::uint64_t first = read(ops[0].reg);
+            const std::uint64_t second = read(ops[1].reg);
+            const std::uint64_t addr = address(ops[2]);
+            const std::uint64_t base = read(ops[2].reg);
+            stats.stores++;
+            store(addr, first);
+            store(addr + 8, second);
+            writeback(ops[2], base);
+            break;
+        }
+        case Op::Ld1: {
+            const std::uint64_t addr = address(ops[1]);
+            stats.loads++;
+            write_vector(ops[0].reg, {load(addr), load(addr + 8)});
+            break;
+        }
+        case Op::St1: {
+            const auto value = read_vector(ops[0].reg);
+            const std::uint64_t addr = address(ops[1]);
+            stats.stores++;
+            store(addr, value[0]);
+            store(addr + 8, value[1]);
+            break;
+        }
+        case Op::Dup: {
+            const std::uint64_t a = read(ops[1].reg);
+            write_vector(ops[0].reg, {a, a});
+            break;
+        }
+        case Op::B:
+            branch = inst.target;
+            break;
+        case Op::BCond:
+            if (read_cond(ops[0].cond))
+                branch = inst.target;
+            break;
+        case Op::Cbz:
+        case Op::Cbnz:
+            if ((read(ops[0].reg) == 0) == (inst.op == Op::Cbz))
+                branch = inst.target;
+            break;
+        case Op::Bl:
+            write(reg_lr, pc + 1);
+            branch = inst.target;
+            break;
+        case Op::Ret: {
+            const std::uint64_t lr = read(reg_lr);
+            stats.branches++;
+            stats.taken_branches++;
+            stats.cycles = issue + taken_branch_penalty;
+            if (lr == return_sentinel)
+                return {read(0), stats};
+            ASSERT(lr < program.size());
+            pc = lr;
+            continue;
+        }
+        case Op::Svc:
+            // exit(x0) is the only system call smolcc makes
+            ASSERT(read(8) == 93);
+            stats.cycles = issue;
+            return {read(0), stats};
+        }
+
+        const bool is_branch = inst.op == Op::B || inst.op == Op::BCond || inst.op == Op::Cbz || inst.op == Op::Cbnz || inst.op == Op::Bl;
+        if (is_branch)
+            stats.branches++;
+        stats.cycles = issue;
+        if (branch) {
+            stats.taken_branches++;
+            stats.cycles += taken_branch_penalty;
+            pc = *branch;
+        } else {
+            pc++;
+        }
+    }
+}
+
+SimulationResult simulate(std::string_view assembly) {
+    std::vector<Instruction> program;
+    std::unordered_map<std::string, std::size_t> labels;
+
+    while (!assembly.empty()) {
+        const std::size_t newline = assembly.find('\n');
+        const std::string_view line = trim(assembly.substr(0, newline));
+        assembly.remove_prefix(newline == std::string_view::npos ? assembly.size() : newline + 1);
+        if (line.empty())
+            continue;
+
+        if (line.ends_with(':'))
+            labels.emplace(line.substr(0, line.size() - 1), program.size());
+        else if (!line.starts_with('.'))
+            program.push_back(parse_instruction(line));
+    }
+
+    for (Instruction& inst : program) {
+        if (!inst.operands.empty() && inst.operands.back().kind == Operand::Kind::Label) {
+            const auto it = labels.find(inst.operands.back().label);
+            ASSERT(it != labels.end());
+            inst.target = it->second;
+        }
+    }
+
+    auto entry = labels.find("_start");
+    if (entry == labels.end())
+        entry = labels.find("_main");
+    if (entry == labels.end())
+        entry = labels.find("main");
+    ASSERT(entry != labels.end());
+
+    return Machine{std::move(program), entry->second}.run();
+}
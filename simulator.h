@@ -0,0 +1,27 @@
+// This file is part of the smolcc project
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+// Dynamic counts from one simulated run
+struct SimulationStats {
+    std::uint64_t instructions = 0;
+    std::uint64_t loads = 0;
+    std::uint64_t stores = 0;
+    std::uint64_t branches = 0;
+    std::uint64_t taken_branches = 0;
+    std::uint64_t cycles = 0;
+};
+
+struct SimulationResult {
+    std::uint64_t exit_code;
+    SimulationStats stats;
+};
+
+// Executes the assembly smolcc emits, for either target, from its entry point until main returns
+// or the program exits. Cycles come from a single-issue in-order pipeline: each instruction waits
+// for its operands' results, and a taken branch costs a fetch bubble.
+SimulationResult simulate(std::string_view assembly);
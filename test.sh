@@ -26,3 +26,201 @@ echo expect 0
 ./build.sh "{ int x; int y; *(&x+1) = 42; x; }"
 echo expect 42
 ./build.sh "{ int x; int y; *(&x+1) = 42; y; }"
+echo expect 7
+./build.sh "{ int x; x = 0; if (x == 0) return 7; return 9; }"
+echo expect 45
+./build.sh "{ int i; int s; s = 0; for (i = 0; i < 10; i = i + 1) s = s + i; return s; }"
+echo expect 2
+./build.sh "{ if (5 >= 6) 1; else 2; }"
+echo expect 120
+./build.sh "{ int i; int x; int s; s = 0; x = 3; for (i = 0; i < 10; i = i + 1) s = s + x * 4; return s; }"
+echo expect 12
+./build.sh "{ int i; int x; int s; s = 0; x = 1; for (i = 0; i < 3; i = i + 1) { s = s + x * 2; *(&x + 0) = x + 1; } return s; }"
+echo expect 5
+./build.sh "{ int i; int x; int y; y = 0; for (i = 0; i < 5; i = i + 1) *(&x + 1) = y + 1; return y; }"
+echo expect 6
+./build.sh "{ int i; int a; int b; int c; int s; a = 1; b = 2; c = 3; s = 0; for (i = 0; i < 3; i = i + 1) s = s + *(&a + i); return s; }"
+echo expect 5
+./build.sh "{ int i; int a; int b; int c; int s; a = 1; b = 2; c = 3; s = 0; for (i = 2; i > 0; i = i - 1) s = s + *(&a + i); return s; }"
+echo expect 2
+./build.sh "{ int a; int b; return &b + 1 - &a; }"
+echo expect 30
+./build.sh "{ int i; int s; s = 0; for (i = 10; i > 0; i = i - 2) s = s + i; return s; }"
+echo expect 22
+./build.sh "{ int i; int n; int s; s = 0; n = 22; for (i = 0; i < n; i = i + 1) s = s + 1; return s; }"
+echo expect 100
+./build.sh "{ int i; int j; int s; s = 0; for (i = 0; i < 10; i = i + 1) for (j = 0; j < 10; j = j + 1) s = s + 1; return s; }"
+echo expect 14
+./build.sh "{ int i; int n; int a0; int a1; int a2; int a3; int a4; int b0; int b1; int b2; int b3; int b4; a0 = 1; a1 = 2; a2 = 3; a3 = 4; a4 = 5; n = 5; for (i = 0; i < n; i = i + 1) *(&b0 + i) = *(&a0 + i) + 10; return b4 - b0 + b2 - 3; }"
+echo expect 7
+./build.sh "{ int a0; int a1; int a2; int i; int n; n = 3; for (i = 0; i < 4; i = i + 1) *(&a0 + i) = 7; return a2 + n - n; }"
+echo expect 5
+./build.sh "{ int i; int a0; int a1; int a2; int a3; int a4; a0 = 1; a1 = 2; a2 = 3; a3 = 4; a4 = 5; for (i = 0; i < 4; i = i + 1) *(&a1 + i) = *(&a0 + i) + 0; return a0 + a1 + a2 + a3 + a4; }"
+echo expect 3
+./build.sh "{ return 3; return 4; }"
+echo expect 5
+./build.sh "{ int x; x = 5; while (0) x = 1; return x; }"
+echo expect 8
+./build.sh "{ if (2 > 1) return 8; else return 9; }"
+echo expect 7
+./build.sh "{ int x; x = 0 - 7; return x / 2 + 10; }"
+echo expect 9
+./build.sh "{ int x; x = 0 - 7; return x % 3 + 10; }"
+echo expect 6
+./build.sh "{ int x; int y; x = 100; y = 0 - 7; return x / y + 20; }"
+echo expect 142
+./build.sh "{ int x; x = 1000; return x / 7; }"
+echo expect 1
+./build.sh "{ int x; x = 0 - 1; return x == 0 - 1; }"
+echo expect 1
+./build.sh "{ int x; x = 0 - 2; return x + 3; }"
+echo expect 105
+./build.sh "{ int x; x = 4294901760; return x / 65536 - 65430; }"
+echo expect 2
+./build.sh "{ int x; int y; x = 1; x = 2; y = x; return y; }"
+echo expect 42
+./build.sh "{ int x; x = 42; }"
+echo expect 7
+./build.sh "{ int x; int y; x = 7; y = 3; return *(&y - 1); }"
+echo expect 21
+./build.sh "{ int x; int s; s = 0; for (x = 0; x < 10; x = x + 1) { if (x == 7) return s; s = s + x; } return 99; }"
+echo expect 9
+./build.sh "{ int x; x = 3; if (x < 2) { int y; y = 5; return y; } else { int z; z = 9; } return *(&x + 2); }"
+echo expect 4
+./build.sh "{ int x; int n; x = 0; n = 0; while (x < 4) { if (x > 9) return 1; else n = n + 1; x = x + 1; } n; }"
+echo expect 1
+./build.sh "{ int a; int b; int c; a = 1; b = 2; c = 3; a > b && b > c || c == 3; }"
+echo expect 3
+./build.sh "{ int a; int b; a = 0; b = 3; a && (b = 7); b; }"
+echo expect 6
+./build.sh "{ int i; int n; n = 0; for (i = 0; i < 10 && n < 6; i = i + 1) n = n + 1; n; }"
+echo expect 249
+./build.sh "{ int a; int x; a = 5; x = 7; if (a < 2) x = a; else x = 0 - x; x + 256; }"
+echo expect 3
+./build.sh "{ int i; int x; int n; n = 0; for (i = 0; i < 7; i = i + 1) { if (i % 2) x = 1; else x = 0; n = n + x; } n; }"
+echo expect 4
+./build.sh "{ int a; a = 2; if (a == 1) return 3; else return 4; }"
+echo expect 50
+./build.sh "{ int a0; int a1; int a2; int a3; int a4; int a5; int a6; int a7; int a8; int a9; int a10; int a11; int a12; int a13; int a14; int a15; int a16; int a17; int a18; int a19; int a20; int a21; int a22; int a23; int a24; int a25; int a26; int a27; int a28; int a29; int i; a0 = 3; a1 = 4; a2 = 0; for (i = 0; i < 5; i = i + 1) a2 = a2 + a0 * a1 + (a0 - a1) * 2; return a2; }"
+echo expect 12
+./build.sh "{ int a0; int a1; int a2; int a3; int a4; int a5; int a6; int a7; int a8; int a9; int a10; int a11; int a12; int a13; int a14; int a15; int a16; int a17; int a18; int a19; int a20; int a21; int a22; int a23; int a24; int a25; int a26; int a27; int a28; int a29; int a30; int i; a0 = 3; a1 = 4; a2 = 5; a3 = 0; for (i = 0; i < 3; i = i + 1) a3 = a3 + *(&a0 + i); return a3; }"
+echo expect 2
+printf '1 1\n9\nreturn (;2 1\n10\nreturn 42;' | ./build/main --serve 2>/dev/null | grep -cE '^(1 error|2) [0-9]+$'
+echo expect 1
+rm -rf build/cache && ./build/main -fcache-dir=build/cache "return 42;" > /dev/null && for f in build/cache/*; do sed 's/movz x0, 42/movz x0, 43/' "$f" > "$f.tmp" && mv "$f.tmp" "$f"; done && ./build/main -fcache-dir=build/cache "return 42;" | grep -c "movz x0, 43"
+echo expect 0
+./build/main -fcache-dir=build/cache -g0 "return 42;" | grep -c "movz x0, 43"
+echo expect 2
+printf '1 2\n23\n-fcache-dir=build/cache10\nreturn 42;2 2\n23\n-fcache-dir=build/cache10\nreturn 42;' | ./build/main --serve | grep -c "movz x0, 43"
+echo expect 1
+(cd / && PATH="$OLDPWD/build:$PATH" main -fcache-dir="$OLDPWD/build/cache" "return 42;") | grep -c "movz x0, 43"
+echo expect 0
+touch build/main && (cd / && PATH="$OLDPWD/build:$PATH" main -fcache-dir="$OLDPWD/build/cache" "return 42;") | grep -c "movz x0, 43"
+echo expect 7
+./build.sh "{ int x; x = 7; x; int y; }"
+echo expect 7
+./build.sh "{ int x; x = 7; x; ; { int y; } }"
+echo expect 2
+./build/main -g0 "{ int x; x = 0; *(&x) = 0; x; }" | grep -c "str xzr"
+echo expect 0
+./build/main -g0 "{ int x; x = 0; *(&x) = 0; x; }" | grep -c "movz"
+echo expect 1
+./build/main -g0 "{ int x; x = 5; return 0 < x; }" | grep -c "cmp xzr, x0"
+echo expect 1
+./build/main -g0 "{ int x; x = 5; return 0 - x * 3; }" | grep -c "sub x0, xzr, x0"
+echo expect 120
+FLAGS=-mcpu=cortex-a76 ./build.sh "{ int i; int x; int s; s = 0; x = 3; for (i = 0; i < 10; i = i + 1) s = s + x * 4; return s; }"
+echo expect 12
+FLAGS=-mcpu=cortex-a76 ./build.sh "{ int i; int x; int s; s = 0; x = 1; for (i = 0; i < 3; i = i + 1) { s = s + x * 2; *(&x + 0) = x + 1; } return s; }"
+echo expect 6
+FLAGS=-mcpu=cortex-a76 ./build.sh "{ int i; int a; int b; int c; int s; a = 1; b = 2; c = 3; s = 0; for (i = 0; i < 3; i = i + 1) s = s + *(&a + i); return s; }"
+echo expect 100
+FLAGS=-mcpu=cortex-a76 ./build.sh "{ int i; int j; int s; s = 0; for (i = 0; i < 10; i = i + 1) for (j = 0; j < 10; j = j + 1) s = s + 1; return s; }"
+echo expect 14
+FLAGS=-mcpu=cortex-a76 ./build.sh "{ int i; int n; int a0; int a1; int a2; int a3; int a4; int b0; int b1; int b2; int b3; int b4; a0 = 1; a1 = 2; a2 = 3; a3 = 4; a4 = 5; n = 5; for (i = 0; i < n; i = i + 1) *(&b0 + i) = *(&a0 + i) + 10; return b4 - b0 + b2 - 3; }"
+echo expect 5
+FLAGS=-mcpu=cortex-a76 ./build.sh "{ int i; int a0; int a1; int a2; int a3; int a4; a0 = 1; a1 = 2; a2 = 3; a3 = 4; a4 = 5; for (i = 0; i < 4; i = i + 1) *(&a1 + i) = *(&a0 + i) + 0; return a0 + a1 + a2 + a3 + a4; }"
+echo expect 7
+FLAGS=-mcpu=cortex-a76 ./build.sh "{ int x; x = 0 - 7; return x / 2 + 10; }"
+echo expect 9
+FLAGS=-mcpu=cortex-a76 ./build.sh "{ int x; x = 0 - 7; return x % 3 + 10; }"
+echo expect 6
+FLAGS=-mcpu=cortex-a76 ./build.sh "{ int x; int y; x = 100; y = 0 - 7; return x / y + 20; }"
+echo expect 142
+FLAGS=-mcpu=cortex-a76 ./build.sh "{ int x; x = 1000; return x / 7; }"
+echo expect 105
+FLAGS=-mcpu=cortex-a76 ./build.sh "{ int x; x = 4294901760; return x / 65536 - 65430; }"
+echo expect 3
+FLAGS=-mcpu=cortex-a76 ./build.sh "{ int i; int x; int n; n = 0; for (i = 0; i < 7; i = i + 1) { if (i % 2) x = 1; else x = 0; n = n + x; } n; }"
+echo expect 120
+FLAGS=-mcpu=apple-m1 ./build.sh "{ int i; int x; int s; s = 0; x = 3; for (i = 0; i < 10; i = i + 1) s = s + x * 4; return s; }"
+echo expect 12
+FLAGS=-mcpu=apple-m1 ./build.sh "{ int i; int x; int s; s = 0; x = 1; for (i = 0; i < 3; i = i + 1) { s = s + x * 2; *(&x + 0) = x + 1; } return s; }"
+echo expect 6
+FLAGS=-mcpu=apple-m1 ./build.sh "{ int i; int a; int b; int c; int s; a = 1; b = 2; c = 3; s = 0; for (i = 0; i < 3; i = i + 1) s = s + *(&a + i); return s; }"
+echo expect 100
+FLAGS=-mcpu=apple-m1 ./build.sh "{ int i; int j; int s; s = 0; for (i = 0; i < 10; i = i + 1) for (j = 0; j < 10; j = j + 1) s = s + 1; return s; }"
+echo expect 14
+FLAGS=-mcpu=apple-m1 ./build.sh "{ int i; int n; int a0; int a1; int a2; int a3; int a4; int b0; int b1; int b2; int b3; int b4; a0 = 1; a1 = 2; a2 = 3; a3 = 4; a4 = 5; n = 5; for (i = 0; i < n; i = i + 1) *(&b0 + i) = *(&a0 + i) + 10; return b4 - b0 + b2 - 3; }"
+echo expect 5
+FLAGS=-mcpu=apple-m1 ./build.sh "{ int i; int a0; int a1; int a2; int a3; int a4; a0 = 1; a1 = 2; a2 = 3; a3 = 4; a4 = 5; for (i = 0; i < 4; i = i + 1) *(&a1 + i) = *(&a0 + i) + 0; return a0 + a1 + a2 + a3 + a4; }"
+echo expect 7
+FLAGS=-mcpu=apple-m1 ./build.sh "{ int x; x = 0 - 7; return x / 2 + 10; }"
+echo expect 9
+FLAGS=-mcpu=apple-m1 ./build.sh "{ int x; x = 0 - 7; return x % 3 + 10; }"
+echo expect 6
+FLAGS=-mcpu=apple-m1 ./build.sh "{ int x; int y; x = 100; y = 0 - 7; return x / y + 20; }"
+echo expect 142
+FLAGS=-mcpu=apple-m1 ./build.sh "{ int x; x = 1000; return x / 7; }"
+echo expect 105
+FLAGS=-mcpu=apple-m1 ./build.sh "{ int x; x = 4294901760; return x / 65536 - 65430; }"
+echo expect 3
+FLAGS=-mcpu=apple-m1 ./build.sh "{ int i; int x; int n; n = 0; for (i = 0; i < 7; i = i + 1) { if (i % 2) x = 1; else x = 0; n = n + x; } n; }"
+echo expect 3
+printf '7 1\n9\nreturn 7;3 1\n9\nreturn 3;5 1\n9\nreturn 5;' | ./build/main --serve | awk '!n { split($0, h, " "); id = h[1]; n = h[2]; next } { n -= length($0) + 1 } $1 == "movz" && $3 == id { ok++ } END { print ok }'
+echo expect 123
+rm -rf build/batch && mkdir build/batch && printf 'return 1;' > build/batch/a.c && printf 'return 2;' > build/batch/b.c && printf 'return 3;' > build/batch/c.c && printf 'build/batch/c.c\n' > build/batch/list && ./build/main -g0 --batch build/batch/a.c build/batch/b.c @build/batch/list && grep -h movz build/batch/a.s build/batch/b.s build/batch/c.s | awk '{ printf "%s", $3 } END { print "" }'
+echo expect 1
+printf 'return 1;' > build/batch/d.s && (./build/main --batch build/batch/d.s > /dev/null; true) 2> /dev/null; grep -c "return 1;" build/batch/d.s
+echo expect 7
+FLAGS=-g0 ./build.sh "{ int x; int y; x = 7; y = 3; return *(&y - 1); }"
+echo expect 7
+FLAGS=-gline-tables-only ./build.sh "{ int x; int y; x = 7; y = 3; return *(&y - 1); }"
+echo expect 7
+FLAGS=-g ./build.sh "{ int x; int y; x = 7; y = 3; return *(&y - 1); }"
+echo expect 0
+./build/main -g0 "{ int x; int y; x = 7; y = 3; return *(&y - 1); }" | grep -cE '^\.(loc|file)'
+echo expect 1
+./build/main -gline-tables-only "{ int x; int y; x = 7; y = 3; return *(&y - 1); }" | grep -c '^\.file'
+echo expect 0
+./build/main -gline-tables-only "{ int x; int y; x = 7; y = 3; return *(&y - 1); }" | grep '^\.loc' | uniq -d | grep -c .
+echo expect 1
+./build/main -g "{ int x; int y; x = 7; y = 3; return *(&y - 1); }" | grep '^\.loc' | uniq -d | grep -c .
+echo expect 3
+./build.sh "{ int i; for (i = 0; i < 3; i = i + 1) ; }"
+echo expect 3
+FLAGS=-O0 ./build.sh "{ int i; for (i = 0; i < 3; i = i + 1) ; }"
+echo expect 5
+./build.sh "{ int i; int s; s = 0; for (i = 0; i < 5; i = i + 1) s = s + i; }"
+echo expect 0
+./build.sh "{ int i; i = 2; while (i) i = i - 1; }"
+echo expect 7
+./build.sh "{ int n; int i; n = 7; for (i = 0; i < n; i = i + 2) ; }"
+echo expect 10
+./build.sh "{ int i; for (i = 0; 9 > i; i = i + 2) ; }"
+echo expect 57
+./build.sh "{ int a; int b; int c; int s; int i; a = 1; b = 2; c = 3; s = 0; for (i = 2; i >= 0; i = i + -1) s = s * 4 + *(&a + i); return s; }"
+echo expect 57
+./build.sh "{ int a; int b; int c; int s; int i; a = 1; b = 2; c = 3; s = 0; for (i = 0; i > 0 - 3; i = i - 1) s = s * 4 + *(&c + i); return s; }"
+echo expect 27
+./build.sh "{ int a; int b; int c; int s; int i; a = 1; b = 2; c = 3; s = 0; for (i = 0; i < 3; i = i - -1) s = s * 4 + *(&a + i); return s; }"
+echo expect 7
+./build.sh "{ int i; for (i = 0; i < 10; i = i + -1) { if (i < 0 - 5) return 7; } return 9; }"
+echo expect 4
+./build.sh "{ int i; int s; s = 4; for (i = 20; i > 10; i = i - -3) { if (i > 25) return s; } return 99; }"
+echo expect 45
+./build.sh "{ int i; int s; s = 0; for (i = 9; i >= 0; i = i + -1) s = s + i; return s; }"
+echo expect 46
+./build.sh "{ int i; int s; s = 0; for (i = 0; i < 9223372036854775807; i = i + 4611686018427387904) { s = s + 1; if (s > 5) return 40 + s; } return s; }"
+echo expect 224
+./build.sh "{ int i; int j; int s; s = 0; for (i = 7; i >= 0; i = i - 1) { for (j = 7; j >= 0; j = j - 1) { s = s + j; } } return s; }"
@@ -1,2 +1,7 @@
-as true.s -o true.o
-ld -macosx_version_min 12.0.0 -o true true.o -lSystem -syslibroot `xcrun -sdk macosx --show-sdk-path` -arch arm64
+if [ "$(uname)" = Linux ]; then
+    ${CROSS_PREFIX-aarch64-linux-gnu-}as true-linux.s -o true.o
+    ${CROSS_PREFIX-aarch64-linux-gnu-}ld -o true true.o
+else
+    as true.s -o true.o
+    ld -macosx_version_min 12.0.0 -o true true.o -lSystem -syslibroot `xcrun -sdk macosx --show-sdk-path` -arch arm64
+fi
@@ -0,0 +1,7 @@
+.text
+.globl _start
+.align 4
+_start:
+    mov x0, 1
+    mov x8, 93
+    svc 0
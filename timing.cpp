@@ -0,0 +1,113 @@
+// This file is part of the smolcc project
+// SPDX-License-Identifier: MIT
+
+#include "timing.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include <time.h>
+
+#include <fmt/core.h>
+
+namespace {
+
+struct Sample {
+    std::int64_t wall_ns;
+    std::int64_t cpu_ns;
+};
+
+struct Totals {
+    std::atomic<std::int64_t> wall_ns = 0;
+    std::atomic<std::int64_t> cpu_ns = 0;
+};
+
+}  // namespace
+
+static constexpr std::array<std::string_view, static_cast<std::size_t>(Phase::Count)> phase_names{
+        "input",
+        "lex",
+        "parse",
+        "types",
+        "optimize",
+        "codegen",
+        "schedule",
+        "cache",
+        "output",
+};
+
+static std::array<Totals, static_cast<std::size_t>(Phase::Count)> totals;
+
+// The phase this thread is in, Phase::Count outside all of them, and when it was entered
+static thread_local Phase current = Phase::Count;
+static thread_local Sample since;
+
+static Sample sample() {
+    timespec cpu;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &cpu);
+    const auto wall = std::chrono::steady_clock::now().time_since_epoch();
+    return {std::chrono::duration_cast<std::chrono::nanoseconds>(wall).count(), cpu.tv_sec * 1'000'000'000LL + cpu.tv_nsec};
+}
+
+// Charges the time since the last switch to the current phase and restarts the clock
+static void switch_to(Phase phase) {
+    const Sample now = sample();
+    if (current != Phase::Count) {
+        Totals& t = totals[static_cast<std::size_t>(current)];
+        t.wall_ns.fetch_add(now.wall_ns - since.wall_ns, std::memory_order_relaxed);
+        t.cpu_ns.fetch_add(now.cpu_ns - since.cpu_ns, std::memory_order_relaxed);
+    }
+    current = phase;
+    since = now;
+}
+
+Phase current_phase() {
+    return current;
+}
+
+std::string_view phase_name(Phase phase) {
+    return phase == Phase::Count ? "none" : phase_names[static_cast<std::size_t>(phase)];
+}
+
+void PhaseTimer::enter(Phase phase) {
+    if (current == phase)
+        return;
+    active = true;
+    saved = current;
+    switch_to(phase);
+}
+
+void PhaseTimer::leave() {
+    switch_to(saved);
+}
+
+std::string time_report(TimeReportFormat format) {
+    double wall_total = 0;
+    double cpu_total = 0;
+    for (const Totals& t : totals) {
+        wall_total += t.wall_ns.load() / 1e6;
+        cpu_total += t.cpu_ns.load() / 1e6;
+    }
+
+    std::string out;
+    if (format == TimeReportFormat::Json) {
+        out += "{";
+        for (std::size_t i = 0; i < totals.size(); i++)
+            out += fmt::format("\"{}\": {{\"wall_ms\": {:.3f}, \"cpu_ms\": {:.3f}}}, ", phase_names[i], totals[i].wall_ns.load() / 1e6, totals[i].cpu_ns.load() / 1e6);
+        out += fmt::format("\"total\": {{\"wall_ms\": {:.3f}, \"cpu_ms\": {:.3f}}}}}\n", wall_total, cpu_total);
+        return out;
+    }
+
+    // Times are summed over threads, so batch totals can exceed the elapsed time
+    out += fmt::format("{:<10} {:>12} {:>12} {:>7}\n", "phase", "wall (ms)", "cpu (ms)", "wall %");
+    for (std::size_t i = 0; i < totals.size(); i++) {
+        const double wall = totals[i].wall_ns.load() / 1e6;
+        out += fmt::format("{:<10} {:>12.3f} {:>12.3f} {:>6.1f}%\n", phase_names[i], wall, totals[i].cpu_ns.load() / 1e6, wall_total > 0 ? 100 * wall / wall_total : 0.0);
+    }
+    out += fmt::format("{:<10} {:>12.3f} {:>12.3f} {:>6.1f}%\n", "total", wall_total, cpu_total, 100.0);
+    return out;
+}
@@ -0,0 +1,61 @@
+// This file is part of the smolcc project
+// SPDX-License-Identifier: MIT
+
+#pragma once
+
+#include <string>
+#include <string_view>
+
+// Compiler phases reported by -ftime-report
+enum class Phase {
+    Input,
+    Lex,
+    Parse,
+    Types,
+    Optimize,
+    Codegen,
+    Schedule,
+    Cache,
+    Output,
+    Count,
+};
+
+enum class TimeReportFormat {
+    Table,
+    Json,
+};
+
+// Set once, before any compile starts
+inline bool timing_enabled = false;
+
+// Charges the wall-clock and thread CPU time of its scope to `phase`. Time is exclusive: a nested
+// timer for another phase pauses this one, and a nested timer for the same phase costs nothing, so
+// recursive phases can be timed at every entry point. Disabled timers cost a branch.
+class PhaseTimer {
+public:
+    explicit PhaseTimer(Phase phase) {
+        if (timing_enabled)
+            enter(phase);
+    }
+    ~PhaseTimer() {
+        if (active)
+            leave();
+    }
+
+    PhaseTimer(const PhaseTimer&) = delete;
+    PhaseTimer& operator=(const PhaseTimer&) = delete;
+
+private:
+    void enter(Phase phase);
+    void leave();
+
+    bool active = false;
+    Phase saved;
+};
+
+// The phase this thread is in, Phase::Count outside all phases or while timing is disabled
+Phase current_phase();
+std::string_view phase_name(Phase phase);
+
+// Totals over every thread so far
+std::string time_report(TimeReportFormat format);
@@ -6,6 +6,8 @@
 #include <cstddef>
 #include <memory>
 
+#include "alloc_trace.h"
+
 struct Type {
     virtual ~Type() = default;
     virtual bool is_pointer() const { return false; }
@@ -37,6 +39,7 @@ struct PrimitiveType : public Type {
 };
 
 inline TypeVal make_int_type() {
+    TRACE_ALLOCATIONS(MakeIntType);
     return make_type<PrimitiveType>(PrimitiveTypeKind::Int);
 }
 
@@ -50,5 +53,6 @@ struct PointerType : public Type {
 };
 
 inline TypeVal make_ptr_type(TypeVal inner) {
+    TRACE_ALLOCATIONS(MakePtrType);
     return make_type<PointerType>(std::move(inner));
 }